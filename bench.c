@@ -0,0 +1,659 @@
+/*
+  Microbenchmarks of the hot kernels of `ss`, built and run by `make bench`.
+
+  Nothing here talks to the X server or creates a GL context: captures are
+  synthetic XImages filled with deterministic noise, and the canvas is a
+  plain RGBA buffer. Results are printed to stdout as one JSON object,
+  pass a substring to run only the benchmarks whose names contain it.
+
+  `check` instead of a filter runs every conversion kernel against the
+  generic one, and every `bgrx_to_rgb_row` version the CPU can run against
+  the scalar one, and exits with 1 if any of them disagrees, see `make check`.
+*/
+
+#define main ss_main
+#include "ss.c"
+#undef main
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Every case runs at least `BENCH_MIN_RUNS` times and then until it has
+// taken `BENCH_MIN_NS` in total or has run `BENCH_MAX_RUNS` times
+#define BENCH_MIN_RUNS 5
+#define BENCH_MAX_RUNS 200
+#define BENCH_MIN_NS 500000000ull
+
+typedef struct {
+	const char *name;
+	u32 w, h;
+} BenchSize;
+
+static const BenchSize bench_sizes[] = {
+	{"1080p", 1920, 1080},
+	{"4k", 3840, 2160},
+	{"8k", 7680, 4320},
+	{"3x1080p", 3*1920, 1080},
+};
+
+#define BENCH_SIZES_COUNT (sizeof(bench_sizes) / sizeof(BenchSize))
+
+typedef void (*bench_fn)(void *ctx);
+
+static const char *bench_filter = NULL;
+static bool bench_first_result = true;
+
+static u64 xorshift_state = 0x9E3779B97F4A7C15ull;
+
+INLINE static u64 xorshift(void)
+{
+	xorshift_state ^= xorshift_state << 13;
+	xorshift_state ^= xorshift_state >> 7;
+	xorshift_state ^= xorshift_state << 17;
+	return xorshift_state;
+}
+
+// Gradients with a bit of noise on top, so that the encoders neither get
+// a trivially compressible image nor pure noise
+static void fill_synthetic(u8 *data, u32 w, u32 h, usize stride, u32 bytes_per_pixel)
+{
+	for (u32 y = 0; y < h; y++) {
+		u8 *row = data + y*stride;
+		for (u32 x = 0; x < w; x++) {
+			const u64 noise = xorshift();
+			u8 *p = row + x*bytes_per_pixel;
+			for (u32 c = 0; c < bytes_per_pixel; c++) {
+				p[c] = (u8) ((x*(c + 1) + y*(3 - c % 3)) / 8 + (noise >> (c*8) & 0x0F));
+			}
+		}
+	}
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	const u64 x = *(const u64 *) a;
+	const u64 y = *(const u64 *) b;
+	return (x > y) - (x < y);
+}
+
+INLINE static double percentile_ms(const u64 *sorted, u32 count, double p)
+{
+	const u32 idx = (u32) (p*(count - 1) + 0.5);
+	return sorted[idx] / 1e6;
+}
+
+// Runs `fn` repeatedly and prints a JSON result, `bytes` is what a single
+// run processes and is used for the throughput at the median time
+static void bench_run(const char *name, const char *variant, const BenchSize *size,
+											usize bytes, bench_fn fn, void *ctx)
+{
+	scratch_buffer_clear();
+	scratch_buffer_printf("%s/%s/%s", name, variant, size ? size->name : "-");
+	char *full_name = scratch_buffer_to_string();
+	if (bench_filter && !strstr(full_name, bench_filter)) return;
+
+	u64 runs_ns[BENCH_MAX_RUNS];
+	u32 runs = 0;
+	u64 total_ns = 0;
+
+	while (runs < BENCH_MAX_RUNS && (runs < BENCH_MIN_RUNS || total_ns < BENCH_MIN_NS)) {
+		const u64 start = monotonic_ns();
+		fn(ctx);
+		runs_ns[runs] = monotonic_ns() - start;
+		total_ns += runs_ns[runs++];
+	}
+
+	qsort(runs_ns, runs, sizeof(u64), compare_u64);
+
+	const double p50 = percentile_ms(runs_ns, runs, 0.50);
+	const double mb_per_s = p50 > 0 ? bytes / (p50 / 1e3) / 1e6 : 0;
+
+	printf("%s\n    {\"name\": \"%s\", \"variant\": \"%s\", \"size\": \"%s\", "
+				 "\"width\": %u, \"height\": %u, \"runs\": %u, \"bytes\": %zu, \"mb_per_s\": %.1f, "
+				 "\"min_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+				 bench_first_result ? "" : ",",
+				 name, variant, size ? size->name : "-",
+				 size ? size->w : 0, size ? size->h : 0,
+				 runs, bytes, mb_per_s,
+				 runs_ns[0] / 1e6,
+				 p50,
+				 percentile_ms(runs_ns, runs, 0.90),
+				 percentile_ms(runs_ns, runs, 0.99),
+				 runs_ns[runs - 1] / 1e6);
+	fflush(stdout);
+	bench_first_result = false;
+}
+
+INLINE static void set_threads_count(u32 n)
+{
+	if (pool_initialized) {
+		pool_deinit(&pool);
+		pool_initialized = false;
+	}
+	threads_count = n;
+}
+
+typedef struct {
+	const char *name;
+	int bits_per_pixel, byte_order;
+	unsigned long red_mask, green_mask, blue_mask;
+} BenchVisual;
+
+static const BenchVisual bench_visuals[] = {
+	{"bgrx", 32, LSBFirst, 0xFF0000, 0x00FF00, 0x0000FF},
+	{"rgbx", 32, LSBFirst, 0x0000FF, 0x00FF00, 0xFF0000},
+	{"rgb565", 16, LSBFirst, 0xF800, 0x07E0, 0x001F},
+	{"x2r10g10b10", 32, LSBFirst, 0x3FF00000, 0x000FFC00, 0x000003FF},
+};
+
+#define BENCH_VISUALS_COUNT (sizeof(bench_visuals) / sizeof(BenchVisual))
+
+typedef struct {
+	XImage ximage;
+	u8 *dst;
+	usize dst_stride;
+} ConvertBench;
+
+static void convert_bench(void *ctx)
+{
+	ConvertBench *b = (ConvertBench *) ctx;
+	convert_ximage(&b->ximage, b->dst, b->dst_stride);
+}
+
+static void bench_convert(const BenchSize *size)
+{
+	for (u32 v = 0; v < BENCH_VISUALS_COUNT; v++) {
+		const BenchVisual *visual = &bench_visuals[v];
+
+		ConvertBench b = {0};
+		b.ximage.width = size->w;
+		b.ximage.height = size->h;
+		b.ximage.format = ZPixmap;
+		b.ximage.byte_order = visual->byte_order;
+		b.ximage.bits_per_pixel = visual->bits_per_pixel;
+		b.ximage.depth = visual->bits_per_pixel == 16 ? 16 : 24;
+		b.ximage.bytes_per_line = size->w*(visual->bits_per_pixel / 8);
+		b.ximage.red_mask = visual->red_mask;
+		b.ximage.green_mask = visual->green_mask;
+		b.ximage.blue_mask = visual->blue_mask;
+		b.ximage.data = (char *) malloc((usize) b.ximage.bytes_per_line*size->h);
+		fill_synthetic((u8 *) b.ximage.data, size->w, size->h,
+									 b.ximage.bytes_per_line, visual->bits_per_pixel / 8);
+
+		b.dst_stride = size->w*sizeof(BGRX);
+		b.dst = (u8 *) malloc(b.dst_stride*size->h);
+
+		const usize bytes = (usize) b.ximage.bytes_per_line*size->h;
+
+		scratch_buffer_clear();
+		scratch_buffer_printf("%s/1t", visual->name);
+		set_threads_count(1);
+		bench_run("convert", scratch_buffer_copy(), size, bytes, convert_bench, &b);
+
+		if (pool_default_threads_count() > 1) {
+			scratch_buffer_clear();
+			scratch_buffer_printf("%s/%ut", visual->name, pool_default_threads_count());
+			set_threads_count(0);
+			bench_run("convert", scratch_buffer_copy(), size, bytes, convert_bench, &b);
+		}
+
+		free(b.ximage.data);
+		free(b.dst);
+	}
+}
+
+typedef struct {
+	const u8 *src;
+	u8 *dst;
+	u32 w, h;
+	bgrx_to_rgb_fn fn;
+} BgrxToRgbBench;
+
+static void bgrx_to_rgb_bench(void *ctx)
+{
+	BgrxToRgbBench *b = (BgrxToRgbBench *) ctx;
+	for (u32 y = 0; y < b->h; y++) {
+		b->fn(b->src + (usize) y*b->w*sizeof(BGRX), b->dst + (usize) y*b->w*sizeof(RGB), b->w);
+	}
+}
+
+static void bench_bgrx_to_rgb(const BenchSize *size, const u8 *bgrx)
+{
+	BgrxToRgbBench b = {
+		.src = bgrx,
+		.dst = (u8 *) malloc((usize) size->w*size->h*sizeof(RGB)),
+		.w = size->w,
+		.h = size->h
+	};
+
+	const usize bytes = (usize) size->w*size->h*sizeof(BGRX);
+
+	b.fn = bgrx_to_rgb_row_scalar;
+	bench_run("bgrx_to_rgb", "scalar", size, bytes, bgrx_to_rgb_bench, &b);
+
+	b.fn = select_bgrx_to_rgb();
+	if (b.fn != bgrx_to_rgb_row_scalar) {
+		bench_run("bgrx_to_rgb", "selected", size, bytes, bgrx_to_rgb_bench, &b);
+	}
+
+	free(b.dst);
+}
+
+typedef struct {
+	const u8 *src;
+	u32 img_w, img_h;
+	CanvasPixels canvas;
+	region_t rect;
+	u8 *dst;
+} ComposeBench;
+
+static void compose_bench(void *ctx)
+{
+	ComposeBench *b = (ComposeBench *) ctx;
+	compose_region(b->dst, b->rect, b->src, b->img_w, b->img_h, &b->canvas);
+}
+
+static void bench_crop(const BenchSize *size, const u8 *bgrx)
+{
+	// Half of the screen in the middle, and the same area hanging
+	// over the bottom right corner, so that it wraps around both axes,
+	// with nothing drawn
+	ComposeBench b = {
+		.src = bgrx,
+		.img_w = size->w,
+		.img_h = size->h,
+		.rect = {.w = size->w / 2, .h = size->h / 2, .x = size->w / 4, .y = size->h / 4}
+	};
+
+	const usize bytes = (usize) b.rect.w*b.rect.h*sizeof(BGRX);
+	b.dst = (u8 *) malloc(bytes);
+	bench_run("crop", "inside", size, bytes, compose_bench, &b);
+
+	b.rect.x = size->w*3/4;
+	b.rect.y = size->h*3/4;
+	bench_run("crop", "wrapping", size, bytes, compose_bench, &b);
+
+	// A small selection should cost the same on any screen size
+	b.rect = (region_t) {.w = 200, .h = 200, .x = size->w / 3, .y = size->h / 3};
+	bench_run("crop", "200x200", size, (usize) 200*200*sizeof(BGRX), compose_bench, &b);
+
+	free(b.dst);
+}
+
+static void bench_composite(const BenchSize *size, const u8 *bgrx)
+{
+	const usize pixels = (usize) size->w*size->h;
+
+	// Mostly transparent, with a few horizontal brush strokes
+	// and antialiased edges around them, like a real canvas
+	Color *canvas_pixels = (Color *) calloc(pixels, sizeof(Color));
+	for (u32 y = 0; y < size->h; y++) {
+		if (y % 64 >= 6) continue;
+		for (u32 x = size->w / 8; x < size->w*7/8; x++) {
+			const u8 a = y % 64 == 0 || y % 64 == 5 ? 0x80 : 0xFF;
+			canvas_pixels[(usize) y*size->w + x] = (Color) {230, 41, 55, a};
+		}
+	}
+
+	// Tiles are touched where the strokes are, the canvas is
+	// read back bottom-up, which doesn't matter for the timing
+	const u32 tiles_x = (size->w + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+	const u32 tiles_y = (size->h + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+	u64 *tiles = (u64 *) calloc(((usize) tiles_x*tiles_y + 63) / 64, sizeof(u64));
+	for (u32 y = 0; y < size->h; y++) {
+		for (u32 x = 0; x < size->w; x++) {
+			if (!canvas_pixels[(usize) y*size->w + x].a) continue;
+			const u32 idx = (size->h - 1 - y) / CANVAS_TILE_SIZE*tiles_x + x / CANVAS_TILE_SIZE;
+			tiles[idx / 64] |= 1ull << (idx % 64);
+		}
+	}
+
+	ComposeBench b = {
+		.src = bgrx,
+		.img_w = size->w,
+		.img_h = size->h,
+		.canvas = {
+			.pixels = canvas_pixels,
+			.rect = {.w = size->w, .h = size->h},
+			.tiles = tiles,
+			.tiles_x = tiles_x
+		},
+		.rect = {.w = size->w, .h = size->h},
+		.dst = (u8 *) malloc(pixels*sizeof(BGRX))
+	};
+
+	bench_run("composite", "strokes", size, pixels*sizeof(Color), compose_bench, &b);
+
+	free(b.dst);
+	free(canvas_pixels);
+	free(tiles);
+}
+
+typedef struct {
+	Image image;
+	const u8 *bgrx;
+	encode_fn encode;
+} EncodeBench;
+
+static void encode_stb_bench(void *ctx)
+{
+	EncodeBench *b = (EncodeBench *) ctx;
+	int size = 0;
+	MemFree(ExportImageToMemory(b->image, ".png", &size));
+}
+
+static void encode_own_bench(void *ctx)
+{
+	EncodeBench *b = (EncodeBench *) ctx;
+	usize size = 0;
+	free(b->encode(b->bgrx, b->image.width*sizeof(BGRX), b->image.width, b->image.height, &size));
+}
+
+static void bench_encode(const BenchSize *size, const u8 *bgrx)
+{
+	const usize pixels = (usize) size->w*size->h;
+
+	EncodeBench b = {
+		.image = {
+			.data = malloc(pixels*sizeof(RGB)),
+			.width = size->w,
+			.height = size->h,
+			.mipmaps = 1,
+			.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8
+		},
+		.bgrx = bgrx
+	};
+
+	const bgrx_to_rgb_fn bgrx_to_rgb = select_bgrx_to_rgb();
+	for (u32 y = 0; y < size->h; y++) {
+		bgrx_to_rgb(bgrx + (usize) y*size->w*sizeof(BGRX),
+								(u8 *) b.image.data + (usize) y*size->w*sizeof(RGB),
+								size->w);
+	}
+
+	bench_run("encode", "png/stb", size, pixels*sizeof(RGB), encode_stb_bench, &b);
+
+	b.encode = encode_png;
+	png_threads_count = 1;
+	bench_run("encode", "png/1t", size, pixels*sizeof(RGB), encode_own_bench, &b);
+
+	if (pool_default_threads_count() > 1) {
+		scratch_buffer_clear();
+		scratch_buffer_printf("png/%ut", pool_default_threads_count());
+		png_threads_count = 0;
+		bench_run("encode", scratch_buffer_copy(), size, pixels*sizeof(RGB), encode_own_bench, &b);
+	}
+
+	for (u32 i = 1; i < OUTPUT_FORMATS_COUNT; i++) {
+		b.encode = output_formats[i].encode;
+		bench_run("encode", output_formats[i].name, size, pixels*sizeof(RGB), encode_own_bench, &b);
+	}
+
+	free(b.image.data);
+}
+
+typedef struct {
+	bool rescan;
+} FilePathBench;
+
+// Claims a name and gives it back, so every run sees the same directory
+static void file_path_bench(void *ctx)
+{
+	FilePathBench *b = (FilePathBench *) ctx;
+	if (b->rescan) next_output_index = -1;
+
+	const char *file_path = claim_output_file_path();
+	if (file_path) unlink(file_path);
+}
+
+// Fills a fresh directory with `count` earlier screenshots,
+// named the way `claim_output_file_path` itself would have named them
+static void bench_file_path(u32 count)
+{
+	char dir[] = "/tmp/ss-bench-XXXXXX";
+	if (!mkdtemp(dir)) {
+		panic("could not create a temporary directory: %s\n", strerror(errno));
+	}
+
+	char cwd[4096];
+	if (!getcwd(cwd, sizeof(cwd)) || chdir(dir) != 0) {
+		panic("could not enter `%s`: %s\n", dir, strerror(errno));
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		close(open(format_output_file_path(i), O_CREAT | O_WRONLY, 0600));
+	}
+
+	// The first claim of a run scans the directory, the later ones don't
+	FilePathBench b = {.rescan = true};
+	scratch_buffer_clear();
+	scratch_buffer_printf("%u_files/scan", count);
+	bench_run("claim_output_file_path", scratch_buffer_copy(), NULL, 0, file_path_bench, &b);
+
+	b.rescan = false;
+	scratch_buffer_clear();
+	scratch_buffer_printf("%u_files/cached", count);
+	bench_run("claim_output_file_path", scratch_buffer_copy(), NULL, 0, file_path_bench, &b);
+
+	next_output_index = -1;
+
+	DIR *d = opendir(".");
+	for (struct dirent *e; d && (e = readdir(d));) {
+		if (e->d_name[0] != '.') unlink(e->d_name);
+	}
+	if (d) closedir(d);
+
+	if (chdir(cwd) != 0 || rmdir(dir) != 0) {
+		eprintf("could not remove `%s`: %s\n", dir, strerror(errno));
+	}
+}
+
+// Odd widths, so that no kernel gets away with handling pixels in pairs
+static const u32 check_widths[] = {1, 3, 5, 7, 15, 17, 31, 33, 63, 65, 255, 257};
+
+#define CHECK_WIDTHS_COUNT (sizeof(check_widths) / sizeof(u32))
+#define CHECK_ROWS 4
+
+// Compares `kernel` with `convert_row_generic` on noise rows of `layout`,
+// the padding byte is left out since some kernels copy it as is
+static bool check_convert_kernel_rows(ConvertKernel kernel, const PixelLayout *layout)
+{
+	const u32 bytes = layout->bits_per_pixel / 8;
+	const u32 max_w = check_widths[CHECK_WIDTHS_COUNT - 1];
+
+	// One byte more than the rows take, to start them off alignment too
+	u8 *src = (u8 *) malloc((usize) max_w*bytes*CHECK_ROWS + 1);
+	BGRX *expected = (BGRX *) malloc((usize) max_w*sizeof(BGRX));
+	BGRX *got = (BGRX *) malloc((usize) max_w*sizeof(BGRX));
+	bool ok = true;
+
+	for (u32 i = 0; i < CHECK_WIDTHS_COUNT && ok; i++) {
+		const u32 w = check_widths[i];
+		for (usize j = 0; j < (usize) max_w*bytes*CHECK_ROWS + 1; j++) src[j] = (u8) xorshift();
+
+		for (u32 y = 0; y < CHECK_ROWS && ok; y++) {
+			const u8 *row = src + (usize) y*w*bytes + y % 2;
+			convert_row_generic(row, (u8 *) expected, w, layout);
+			kernel.fn(row, (u8 *) got, w, layout);
+
+			for (u32 x = 0; x < w; x++) {
+				if (memcmp(&expected[x], &got[x], 3) == 0) continue;
+				eprintf("`%s` disagrees with `%s` at pixel %u of a %u pixels wide row\n",
+								kernel.name, convert_kernel_generic.name, x, w);
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	free(src);
+	free(expected);
+	free(got);
+	return ok;
+}
+
+// Every kernel on the layout it's there for, and whatever gets selected
+// for the same masks in the other byte order
+static int check_convert_kernels(void)
+{
+	u32 failed = 0;
+
+	for (u32 i = 0; i < CONVERT_KERNELS_COUNT; i++) {
+		const ConvertKernelEntry *e = &convert_kernels[i];
+
+		for (u32 order = 0; order < 2; order++) {
+			const bool msb_first = order ? !e->msb_first : e->msb_first;
+			const PixelLayout layout = pixel_layout(e->bits_per_pixel, msb_first,
+																							e->red_mask, e->green_mask, e->blue_mask);
+			const ConvertKernel kernel = order ? select_convert_kernel(&layout) : e->kernel;
+
+			const bool ok = check_convert_kernel_rows(kernel, &layout);
+			if (!ok) failed++;
+
+			printf("%-26s %2u bpp %s 0x%08X 0x%08X 0x%08X %s\n",
+						 kernel.name, e->bits_per_pixel, msb_first ? "msb" : "lsb",
+						 e->red_mask, e->green_mask, e->blue_mask, ok ? "ok" : "FAILED");
+		}
+	}
+
+	return failed ? 1 : 0;
+}
+
+typedef struct {
+	const char *name;
+	const char *cpu_feature; // NULL when it runs everywhere
+	bgrx_to_rgb_fn fn;
+} BgrxToRgbVariant;
+
+static const BgrxToRgbVariant bgrx_to_rgb_variants[] = {
+#if CONVERT_X86
+	{"bgrx_to_rgb_row_ssse3", "ssse3", bgrx_to_rgb_row_ssse3},
+	{"bgrx_to_rgb_row_avx2", "avx2", bgrx_to_rgb_row_avx2},
+#endif
+	{"bgrx_to_rgb_row_scalar", NULL, bgrx_to_rgb_row_scalar},
+};
+
+#define BGRX_TO_RGB_VARIANTS_COUNT (sizeof(bgrx_to_rgb_variants) / sizeof(BgrxToRgbVariant))
+
+// Widths 0 to this, plus a screen row that leaves a tail for every version
+#define CHECK_RGB_MAX_SHORT_W 64
+#define CHECK_RGB_LONG_W 1919
+// Past the row, where no version may write
+#define CHECK_RGB_GUARD 32
+
+INLINE static bool cpu_supports(const char *feature)
+{
+	if (!feature) return true;
+#if CONVERT_X86
+	__builtin_cpu_init();
+	if (streq(feature, "ssse3")) return __builtin_cpu_supports("ssse3");
+	if (streq(feature, "avx2")) return __builtin_cpu_supports("avx2");
+#endif
+	return false;
+}
+
+// Every width from every source and destination misalignment, guard bytes
+// after the row included, compared with what the scalar version writes
+static bool check_bgrx_to_rgb_variant(bgrx_to_rgb_fn fn)
+{
+	const u32 max_w = CHECK_RGB_LONG_W;
+	u8 *src = (u8 *) malloc((usize) max_w*4 + 4);
+	u8 *expected = (u8 *) malloc((usize) max_w*3 + 4 + CHECK_RGB_GUARD);
+	u8 *got = (u8 *) malloc((usize) max_w*3 + 4 + CHECK_RGB_GUARD);
+	for (usize i = 0; i < (usize) max_w*4 + 4; i++) src[i] = (u8) xorshift();
+
+	for (u32 k = 0; k <= CHECK_RGB_MAX_SHORT_W + 1; k++) {
+		const u32 w = k <= CHECK_RGB_MAX_SHORT_W ? k : CHECK_RGB_LONG_W;
+		for (u32 src_off = 0; src_off < 4; src_off++) {
+			for (u32 dst_off = 0; dst_off < 4; dst_off++) {
+				const usize n = (usize) w*3 + CHECK_RGB_GUARD;
+				memset(expected + dst_off, 0xA5, n);
+				memset(got + dst_off, 0xA5, n);
+
+				bgrx_to_rgb_row_scalar(src + src_off, expected + dst_off, w);
+				fn(src + src_off, got + dst_off, w);
+
+				if (memcmp(expected + dst_off, got + dst_off, n) != 0) {
+					eprintf("disagrees with `bgrx_to_rgb_row_scalar` for %u pixels, "
+									"source off by %u, destination off by %u\n", w, src_off, dst_off);
+					free(src);
+					free(expected);
+					free(got);
+					return false;
+				}
+			}
+		}
+	}
+
+	free(src);
+	free(expected);
+	free(got);
+	return true;
+}
+
+static int check_bgrx_to_rgb_variants(void)
+{
+	u32 failed = 0;
+
+	for (u32 i = 0; i < BGRX_TO_RGB_VARIANTS_COUNT; i++) {
+		const BgrxToRgbVariant *v = &bgrx_to_rgb_variants[i];
+		if (!cpu_supports(v->cpu_feature)) {
+			printf("%-26s skipped, no %s\n", v->name, v->cpu_feature);
+			continue;
+		}
+
+		const bool ok = check_bgrx_to_rgb_variant(v->fn);
+		if (!ok) failed++;
+		printf("%-26s %s\n", v->name, ok ? "ok" : "FAILED");
+	}
+
+	return failed ? 1 : 0;
+}
+
+int main(int argc_, char **argv_)
+{
+	if (argc_ > 2) {
+		eprintf("usage: %s [filter | check]\n", argv_[0]);
+		return 1;
+	}
+
+	if (argc_ == 2 && streq(argv_[1], "check")) {
+		const int convert_failed = check_convert_kernels();
+		const int rgb_failed = check_bgrx_to_rgb_variants();
+		return convert_failed || rgb_failed;
+	}
+	bench_filter = argc_ == 2 ? argv_[1] : NULL;
+
+	memory_init(1);
+	SetTraceLogLevel(LOG_NONE);
+
+	printf("{\"threads\": %u, \"results\": [", pool_default_threads_count());
+
+	for (u32 i = 0; i < BENCH_SIZES_COUNT; i++) {
+		const BenchSize *size = &bench_sizes[i];
+
+		u8 *bgrx = (u8 *) malloc((usize) size->w*size->h*sizeof(BGRX));
+		fill_synthetic(bgrx, size->w, size->h, size->w*sizeof(BGRX), sizeof(BGRX));
+
+		bench_convert(size);
+		bench_bgrx_to_rgb(size, bgrx);
+		bench_crop(size, bgrx);
+		bench_composite(size, bgrx);
+		bench_encode(size, bgrx);
+
+		free(bgrx);
+	}
+
+	const u32 file_counts[] = {10, 100, 1000, 5000};
+	for (u32 i = 0; i < sizeof(file_counts) / sizeof(u32); i++) {
+		bench_file_path(file_counts[i]);
+	}
+
+	printf("\n]}\n");
+
+	if (pool_initialized) pool_deinit(&pool);
+	memory_release();
+
+	return 0;
+}
@@ -0,0 +1,501 @@
+/*
+  End-to-end latency driver, run by bench_e2e.sh against a fresh Xvfb.
+
+  Paints deterministic content over the root window, then times, `runs`
+  times each:
+    - `ss screenshot` from fork to exit, once the PNG is fully written
+    - an interactive `ss` from fork to its first overlay frame, and from
+      a scripted stroke plus Enter (through XTest) to the saved PNG
+    - a resident `ss daemon` from `ss trigger` to its first overlay frame,
+      and from `ss trigger=screenshot` to the saved PNG
+
+  Every `ss` runs in a scratch directory, so that the saved files can be
+  told apart and removed. Latencies are printed as one JSON object.
+
+  Usage: bench_e2e <path to ss> <runs>
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define panic(...) do { \
+	eprintf(__VA_ARGS__); \
+	exit(1); \
+} while (0)
+
+#define MAX_RUNS 1000
+
+// How long to wait for `ss` to draw or write anything before giving up
+#define WAIT_TIMEOUT_NS 30000000000ull
+
+#define FIRST_FRAME_LINE "first frame after"
+#define SOCKET_NAME "ss-bench.sock"
+
+typedef struct {
+	const char *name;
+	u64 ns[MAX_RUNS];
+	u32 count;
+} Series;
+
+static Display *display = NULL;
+static Window root = 0;
+static const char *ss_path = NULL;
+static char work_dir[] = "/tmp/ss-e2e-XXXXXX";
+static bool first_series = true;
+
+static u64 monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64) ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_ms(u32 ms)
+{
+	const struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000)*1000000l};
+	while (nanosleep(&ts, NULL) != 0 && errno == EINTR);
+}
+
+// Same noisy gradients on every run, so that encoding costs stay comparable
+static void paint_root(void)
+{
+	const int screen = DefaultScreen(display);
+	const u32 w = DisplayWidth(display, screen);
+	const u32 h = DisplayHeight(display, screen);
+	const int depth = DefaultDepth(display, screen);
+
+	XImage *ximage = XCreateImage(display,
+																DefaultVisual(display, screen),
+																depth,
+																ZPixmap,
+																0, NULL,
+																w, h,
+																32, 0);
+	if (!ximage) panic("could not create a %ux%u image\n", w, h);
+
+	ximage->data = (char *) malloc((size_t) ximage->bytes_per_line*h);
+
+	u64 state = 0x9E3779B97F4A7C15ull;
+	for (u32 y = 0; y < h; y++) {
+		for (u32 x = 0; x < w; x++) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+
+			const u32 r = (x*255/w) ^ (state & 0x0F);
+			const u32 g = (y*255/h) ^ (state >> 8 & 0x0F);
+			const u32 b = ((x/64 + y/64) % 2)*160 + (state >> 16 & 0x1F);
+			XPutPixel(ximage, x, y, r << 16 | g << 8 | b);
+		}
+	}
+
+	const Pixmap pixmap = XCreatePixmap(display, root, w, h, depth);
+	const GC gc = XCreateGC(display, pixmap, 0, NULL);
+	XPutImage(display, pixmap, gc, ximage, 0, 0, 0, 0, w, h);
+	XFreeGC(display, gc);
+	XDestroyImage(ximage);
+
+	XSetWindowBackgroundPixmap(display, root, pixmap);
+	XClearWindow(display, root);
+	XFreePixmap(display, pixmap);
+	XSync(display, False);
+}
+
+// Starts `argv` in `work_dir`, with its stdout or stderr, as picked by
+// `out_fd`, readable through `*pipe_fd`. Its stdout is thrown away
+// otherwise, so that nothing ends up in the middle of our JSON.
+static pid_t spawn(char *const argv[], int out_fd, int *pipe_fd)
+{
+	int fds[2] = {-1, -1};
+	if (pipe_fd && pipe(fds) != 0) panic("pipe failed: %s\n", strerror(errno));
+
+	const pid_t pid = fork();
+	if (pid < 0) panic("fork failed: %s\n", strerror(errno));
+
+	if (pid == 0) {
+		if (!pipe_fd || out_fd != STDOUT_FILENO) {
+			const int null_fd = open("/dev/null", O_WRONLY);
+			dup2(null_fd, STDOUT_FILENO);
+			close(null_fd);
+		}
+		if (pipe_fd) {
+			dup2(fds[1], out_fd);
+			close(fds[0]);
+			close(fds[1]);
+		}
+		if (chdir(work_dir) != 0) _exit(127);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	if (pipe_fd) {
+		close(fds[1]);
+		*pipe_fd = fds[0];
+	}
+
+	return pid;
+}
+
+static void wait_exit(pid_t pid)
+{
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		panic("`%s` failed with status %d\n", ss_path, status);
+	}
+}
+
+// Reads from `fd` until a line containing `needle` shows up
+static void wait_line(int fd, const char *needle)
+{
+	char buf[4096];
+	size_t len = 0;
+	const u64 deadline = monotonic_ns() + WAIT_TIMEOUT_NS;
+
+	for (;;) {
+		const u64 now = monotonic_ns();
+		if (now >= deadline) panic("timed out waiting for `%s`\n", needle);
+
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		if (poll(&pfd, 1, (int) ((deadline - now) / 1000000)) <= 0) continue;
+
+		const ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (n <= 0) panic("`%s` closed its output before `%s`\n", ss_path, needle);
+
+		len += n;
+		buf[len] = '\0';
+		if (strstr(buf, needle)) return;
+
+		// Keep only the unfinished line around
+		char *last_newline = strrchr(buf, '\n');
+		if (last_newline) {
+			len = strlen(last_newline + 1);
+			memmove(buf, last_newline + 1, len + 1);
+		}
+		if (len == sizeof(buf) - 1) len = 0;
+	}
+}
+
+// A PNG is complete once it ends with its IEND chunk
+static bool png_complete(const char *path)
+{
+	static const u8 iend[12] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82};
+
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	u8 tail[sizeof(iend)];
+	const bool complete = lseek(fd, -(off_t) sizeof(tail), SEEK_END) >= 0 &&
+		read(fd, tail, sizeof(tail)) == (ssize_t) sizeof(tail) &&
+		memcmp(tail, iend, sizeof(iend)) == 0;
+
+	close(fd);
+	return complete;
+}
+
+// Removes everything `ss` has saved so far, returns how many files there were
+static u32 clear_work_dir(void)
+{
+	u32 count = 0;
+	DIR *dir = opendir(work_dir);
+	if (!dir) panic("could not open `%s`: %s\n", work_dir, strerror(errno));
+
+	char path[512];
+	for (struct dirent *e; (e = readdir(dir));) {
+		if (e->d_name[0] == '.' || strstr(e->d_name, ".png") == NULL) continue;
+		snprintf(path, sizeof(path), "%s/%s", work_dir, e->d_name);
+		unlink(path);
+		count++;
+	}
+
+	closedir(dir);
+	return count;
+}
+
+static void wait_png(void)
+{
+	const u64 deadline = monotonic_ns() + WAIT_TIMEOUT_NS;
+	char path[512];
+
+	while (monotonic_ns() < deadline) {
+		DIR *dir = opendir(work_dir);
+		if (!dir) panic("could not open `%s`: %s\n", work_dir, strerror(errno));
+
+		for (struct dirent *e; (e = readdir(dir));) {
+			if (strstr(e->d_name, ".png") == NULL) continue;
+			snprintf(path, sizeof(path), "%s/%s", work_dir, e->d_name);
+			if (png_complete(path)) {
+				closedir(dir);
+				return;
+			}
+		}
+
+		closedir(dir);
+		sleep_ms(1);
+	}
+
+	panic("timed out waiting for a screenshot in `%s`\n", work_dir);
+}
+
+static Window find_ss_window(Window parent)
+{
+	Window root_ret, parent_ret, *children = NULL;
+	unsigned children_count = 0;
+	if (!XQueryTree(display, parent, &root_ret, &parent_ret, &children, &children_count)) return 0;
+
+	Window found = 0;
+	for (unsigned i = 0; i < children_count && !found; i++) {
+		char *name = NULL;
+		if (XFetchName(display, children[i], &name) && name) {
+			if (strcmp(name, "ss") == 0) found = children[i];
+			XFree(name);
+		}
+		if (!found) found = find_ss_window(children[i]);
+	}
+
+	if (children) XFree(children);
+	return found;
+}
+
+// There is no window manager under Xvfb, so the overlay
+// is closed by sending it WM_DELETE_WINDOW directly
+static void close_overlay(void)
+{
+	const Window window = find_ss_window(root);
+	if (!window) panic("could not find the overlay window\n");
+
+	XEvent event = {0};
+	event.xclient.type = ClientMessage;
+	event.xclient.window = window;
+	event.xclient.message_type = XInternAtom(display, "WM_PROTOCOLS", False);
+	event.xclient.format = 32;
+	event.xclient.data.l[0] = XInternAtom(display, "WM_DELETE_WINDOW", False);
+	event.xclient.data.l[1] = CurrentTime;
+
+	XSendEvent(display, window, False, NoEventMask, &event);
+	XSync(display, False);
+}
+
+// Draws a stroke across the middle of the screen and presses Enter
+static void script_session(void)
+{
+	const int screen = DefaultScreen(display);
+	const int cx = DisplayWidth(display, screen) / 2;
+	const int cy = DisplayHeight(display, screen) / 2;
+
+	XTestFakeMotionEvent(display, screen, cx - 200, cy, CurrentTime);
+	XTestFakeButtonEvent(display, 1, True, CurrentTime);
+	XSync(display, False);
+	sleep_ms(20);
+
+	for (int i = 1; i <= 20; i++) {
+		XTestFakeMotionEvent(display, screen, cx - 200 + i*20, cy + (i % 2)*15, CurrentTime);
+		XSync(display, False);
+		sleep_ms(10);
+	}
+
+	XTestFakeButtonEvent(display, 1, False, CurrentTime);
+	XSync(display, False);
+	sleep_ms(20);
+}
+
+static void press_enter(void)
+{
+	const KeyCode enter = XKeysymToKeycode(display, XK_Return);
+	XTestFakeKeyEvent(display, enter, True, CurrentTime);
+	XTestFakeKeyEvent(display, enter, False, CurrentTime);
+	XSync(display, False);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	const u64 x = *(const u64 *) a;
+	const u64 y = *(const u64 *) b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_ms(const u64 *sorted, u32 count, double p)
+{
+	return sorted[(u32) (p*(count - 1) + 0.5)] / 1e6;
+}
+
+static void print_series(Series *s)
+{
+	if (s->count == 0) return;
+
+	qsort(s->ns, s->count, sizeof(u64), compare_u64);
+
+	double mean = 0;
+	for (u32 i = 0; i < s->count; i++) mean += s->ns[i] / 1e6;
+	mean /= s->count;
+
+	printf("%s\n    {\"name\": \"%s\", \"runs\": %u, \"mean_ms\": %.3f, \"min_ms\": %.3f, "
+				 "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+				 first_series ? "" : ",",
+				 s->name, s->count, mean,
+				 s->ns[0] / 1e6,
+				 percentile_ms(s->ns, s->count, 0.50),
+				 percentile_ms(s->ns, s->count, 0.90),
+				 percentile_ms(s->ns, s->count, 0.99),
+				 s->ns[s->count - 1] / 1e6);
+	first_series = false;
+}
+
+static void bench_screenshot(u32 runs)
+{
+	static Series written = {.name = "screenshot/start_to_written"};
+
+	char *argv[] = {(char *) ss_path, "screenshot", NULL};
+	for (u32 i = 0; i < runs; i++) {
+		const u64 start = monotonic_ns();
+		wait_exit(spawn(argv, -1, NULL));
+		written.ns[written.count++] = monotonic_ns() - start;
+
+		if (clear_work_dir() != 1) panic("`ss screenshot` didn't save exactly one file\n");
+	}
+
+	print_series(&written);
+}
+
+static void bench_interactive(u32 runs)
+{
+	static Series first_frame = {.name = "interactive/start_to_first_frame"};
+	static Series saved = {.name = "interactive/enter_to_written"};
+
+	char *argv[] = {(char *) ss_path, "stats", NULL};
+	for (u32 i = 0; i < runs; i++) {
+		int err_fd;
+		const u64 start = monotonic_ns();
+		const pid_t pid = spawn(argv, STDERR_FILENO, &err_fd);
+
+		wait_line(err_fd, FIRST_FRAME_LINE);
+		first_frame.ns[first_frame.count++] = monotonic_ns() - start;
+
+		script_session();
+
+		const u64 enter = monotonic_ns();
+		press_enter();
+		wait_png();
+		saved.ns[saved.count++] = monotonic_ns() - enter;
+
+		// The pipe is only closed once it has exited, `stats` are written at exit
+		close_overlay();
+		wait_exit(pid);
+		close(err_fd);
+		clear_work_dir();
+	}
+
+	print_series(&first_frame);
+	print_series(&saved);
+}
+
+static void bench_daemon(u32 runs)
+{
+	static Series first_frame = {.name = "daemon/trigger_to_first_frame"};
+	static Series written = {.name = "daemon/trigger_to_written"};
+
+	char socket_flag[600];
+	snprintf(socket_flag, sizeof(socket_flag), "socket=%s/%s", work_dir, SOCKET_NAME);
+
+	int err_fd;
+	char *daemon_argv[] = {(char *) ss_path, "daemon", socket_flag, NULL};
+	const pid_t daemon = spawn(daemon_argv, STDERR_FILENO, &err_fd);
+	wait_line(err_fd, "listening at");
+
+	char *overlay_argv[] = {(char *) ss_path, "trigger=overlay", socket_flag, NULL};
+	char *screenshot_argv[] = {(char *) ss_path, "trigger=screenshot", socket_flag, NULL};
+
+	for (u32 i = 0; i < runs; i++) {
+		int out_fd;
+		u64 start = monotonic_ns();
+		pid_t client = spawn(overlay_argv, STDOUT_FILENO, &out_fd);
+		wait_line(out_fd, FIRST_FRAME_LINE);
+		first_frame.ns[first_frame.count++] = monotonic_ns() - start;
+
+		close_overlay();
+		wait_exit(client);
+		close(out_fd);
+
+		start = monotonic_ns();
+		client = spawn(screenshot_argv, STDOUT_FILENO, &out_fd);
+		wait_line(out_fd, "saved");
+		written.ns[written.count++] = monotonic_ns() - start;
+
+		wait_exit(client);
+		close(out_fd);
+		clear_work_dir();
+	}
+
+	char *quit_argv[] = {(char *) ss_path, "trigger=quit", socket_flag, NULL};
+	wait_exit(spawn(quit_argv, -1, NULL));
+	wait_exit(daemon);
+	close(err_fd);
+
+	print_series(&first_frame);
+	print_series(&written);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3) {
+		eprintf("usage: %s <path to ss> <runs>\n", argv[0]);
+		return 1;
+	}
+
+	ss_path = argv[1];
+	const long runs = strtol(argv[2], NULL, 10);
+	if (runs < 1 || runs > MAX_RUNS) panic("runs should be between 1 and %d\n", MAX_RUNS);
+
+	display = XOpenDisplay(NULL);
+	if (!display) panic("could not open X display\n");
+	root = DefaultRootWindow(display);
+
+	int event_base, error_base, major, minor;
+	if (!XTestQueryExtension(display, &event_base, &error_base, &major, &minor)) {
+		panic("the XTEST extension is required to script sessions\n");
+	}
+
+	if (!mkdtemp(work_dir)) panic("could not create a scratch directory: %s\n", strerror(errno));
+
+	paint_root();
+
+	const int screen = DefaultScreen(display);
+	printf("{\"resolution\": \"%dx%d\", \"results\": [",
+				 DisplayWidth(display, screen),
+				 DisplayHeight(display, screen));
+
+	bench_screenshot((u32) runs);
+	bench_interactive((u32) runs);
+	bench_daemon((u32) runs);
+
+	printf("\n]}\n");
+
+	clear_work_dir();
+	rmdir(work_dir);
+	XCloseDisplay(display);
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+# End-to-end latency of `ss` under a private Xvfb, see bench_e2e.c.
+#
+#   RESOLUTIONS  space separated WxH screens to run at (1920x1080 3840x2160)
+#   RUNS         runs of every scenario per resolution (20)
+#   SS           binary under test (./ss)
+#
+# GL is forced to Mesa's software rasterizer, so no GPU is needed and
+# the numbers don't depend on the driver of the machine running it.
+
+set -eu
+
+RESOLUTIONS=${RESOLUTIONS:-"1920x1080 3840x2160"}
+RUNS=${RUNS:-20}
+SS=${SS:-./ss}
+DRIVER=${DRIVER:-./bench_e2e}
+
+LIBGL_ALWAYS_SOFTWARE=1
+export LIBGL_ALWAYS_SOFTWARE
+
+# Display numbers well above the usual ones, so a real session is never touched
+display_num=99
+xvfb_pid=
+
+stop_xvfb() {
+	if [ -n "$xvfb_pid" ]; then
+		kill "$xvfb_pid" 2>/dev/null || true
+		wait "$xvfb_pid" 2>/dev/null || true
+		xvfb_pid=
+	fi
+}
+trap stop_xvfb EXIT INT TERM
+
+printf '['
+first=1
+for resolution in $RESOLUTIONS; do
+	while [ -e "/tmp/.X${display_num}-lock" ]; do
+		display_num=$((display_num + 1))
+	done
+
+	# -displayfd reports the display once the server accepts connections
+	ready=$(mktemp)
+	Xvfb ":$display_num" -screen 0 "${resolution}x24" -nolisten tcp -displayfd 3 3>"$ready" 2>/dev/null &
+	xvfb_pid=$!
+	while [ ! -s "$ready" ]; do
+		if ! kill -0 "$xvfb_pid" 2>/dev/null; then
+			echo "Xvfb failed to start at $resolution" >&2
+			exit 1
+		fi
+		sleep 0.05
+	done
+	rm -f "$ready"
+
+	[ $first -eq 1 ] || printf ','
+	first=0
+	DISPLAY=":$display_num" "$DRIVER" "$SS" "$RUNS"
+
+	stop_xvfb
+done
+printf ']\n'
@@ -0,0 +1,389 @@
+/*
+  Pixel conversion from X server images into 32-bit BGRX pixels, which is
+  the native layout of the common 24/32-bit depth visuals, so converting
+  those is a plain row copy. The X byte is padding: it's copied as is from
+  such visuals and set to 0xFF by every other kernel.
+
+  The layout of a TrueColor image is described once by `PixelLayout`
+  (derived from the image's bits_per_pixel, byte_order and channel masks),
+  then `convert_rows` walks the raw image data row by row, using whatever
+  specialized kernel matches the layout, or the generic one otherwise.
+
+  Encoders that want packed RGB get it through `bgrx_to_rgb_row`, which has
+  SSSE3 and AVX2 versions compiled with per-function target attributes and
+  picked at runtime, so the binary still runs on CPUs without them.
+
+  Nothing in here depends on Xlib, so it can be fed synthetic buffers.
+*/
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define CONVERT_X86 1
+	#include <immintrin.h>
+#else
+	#define CONVERT_X86 0
+#endif
+
+typedef struct {
+	uint8_t shift, width;
+} ChannelLayout;
+
+typedef struct {
+	uint32_t bits_per_pixel;
+	bool msb_first;
+	uint32_t red_mask, green_mask, blue_mask;
+	ChannelLayout red, green, blue;
+} PixelLayout;
+
+typedef void (*convert_row_fn)(const uint8_t *src,
+															 uint8_t *dst,
+															 uint32_t w,
+															 const PixelLayout *layout);
+
+typedef struct {
+	const char *name;
+	convert_row_fn fn;
+} ConvertKernel;
+
+static inline ChannelLayout channel_layout_from_mask(uint32_t mask)
+{
+	ChannelLayout ch = {0};
+	if (mask == 0) return ch;
+	while (!(mask & 1)) { mask >>= 1; ch.shift++; }
+	while (mask & 1)    { mask >>= 1; ch.width++; }
+	return ch;
+}
+
+static inline PixelLayout pixel_layout(uint32_t bits_per_pixel,
+																			 bool msb_first,
+																			 uint32_t red_mask,
+																			 uint32_t green_mask,
+																			 uint32_t blue_mask)
+{
+	return (PixelLayout) {
+		.bits_per_pixel = bits_per_pixel,
+		.msb_first = msb_first,
+		.red_mask = red_mask,
+		.green_mask = green_mask,
+		.blue_mask = blue_mask,
+		.red = channel_layout_from_mask(red_mask),
+		.green = channel_layout_from_mask(green_mask),
+		.blue = channel_layout_from_mask(blue_mask)
+	};
+}
+
+// Scales a `width`-bit channel value to 8 bits: narrower channels replicate
+// their top bits into the low ones (so 0x1F in 5 bits is 0xFF), wider ones
+// are truncated.
+static inline uint8_t scale_channel(uint32_t v, uint8_t width)
+{
+	if (width == 0) return 0;
+	if (width >= 8) return (uint8_t) (v >> (width - 8));
+
+	uint32_t ret = 0, bits = 0;
+	while (bits < 8) {
+		ret = (ret << width) | v;
+		bits += width;
+	}
+
+	return (uint8_t) (ret >> (bits - 8));
+}
+
+static inline uint32_t read_pixel(const uint8_t *p, uint32_t bytes, bool msb_first)
+{
+	uint32_t ret = 0;
+	if (msb_first) {
+		for (uint32_t i = 0; i < bytes; i++) ret = (ret << 8) | p[i];
+	} else {
+		for (uint32_t i = bytes; i > 0; i--) ret = (ret << 8) | p[i - 1];
+	}
+	return ret;
+}
+
+static void convert_row_generic(const uint8_t *src,
+																uint8_t *dst,
+																uint32_t w,
+																const PixelLayout *l)
+{
+	const uint32_t bytes = l->bits_per_pixel / 8;
+	for (uint32_t x = 0; x < w; x++, src += bytes, dst += 4) {
+		const uint32_t p = read_pixel(src, bytes, l->msb_first);
+		dst[0] = scale_channel((p & l->blue_mask)  >> l->blue.shift,  l->blue.width);
+		dst[1] = scale_channel((p & l->green_mask) >> l->green.shift, l->green.width);
+		dst[2] = scale_channel((p & l->red_mask)   >> l->red.shift,   l->red.width);
+		dst[3] = 0xFF;
+	}
+}
+
+// Most common layout by far: 24-bit depth in 32-bit pixels, BGRX in memory
+static void convert_row_bgrx(const uint8_t *src,
+														 uint8_t *dst,
+														 uint32_t w,
+														 const PixelLayout *l)
+{
+	(void) l;
+	memcpy(dst, src, (size_t) w*4);
+}
+
+static void convert_row_rgbx(const uint8_t *src,
+														 uint8_t *dst,
+														 uint32_t w,
+														 const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 4, dst += 4) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = 0xFF;
+	}
+}
+
+static void convert_row_xrgb(const uint8_t *src,
+														 uint8_t *dst,
+														 uint32_t w,
+														 const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 4, dst += 4) {
+		dst[0] = src[3];
+		dst[1] = src[2];
+		dst[2] = src[1];
+		dst[3] = 0xFF;
+	}
+}
+
+static void convert_row_xbgr(const uint8_t *src,
+														 uint8_t *dst,
+														 uint32_t w,
+														 const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 4, dst += 4) {
+		dst[0] = src[1];
+		dst[1] = src[2];
+		dst[2] = src[3];
+		dst[3] = 0xFF;
+	}
+}
+
+static void convert_row_bgr24(const uint8_t *src,
+															uint8_t *dst,
+															uint32_t w,
+															const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 3, dst += 4) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		dst[3] = 0xFF;
+	}
+}
+
+static void convert_row_rgb24(const uint8_t *src,
+															uint8_t *dst,
+															uint32_t w,
+															const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 3, dst += 4) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = 0xFF;
+	}
+}
+
+#define EXPAND_565(p) \
+	const uint32_t r = ((p) >> 11) & 0x1F; \
+	const uint32_t g = ((p) >> 5)  & 0x3F; \
+	const uint32_t b = ((p) >> 0)  & 0x1F; \
+	dst[0] = (uint8_t) ((b << 3) | (b >> 2)); \
+	dst[1] = (uint8_t) ((g << 2) | (g >> 4)); \
+	dst[2] = (uint8_t) ((r << 3) | (r >> 2)); \
+	dst[3] = 0xFF;
+
+static void convert_row_565_lsb(const uint8_t *src,
+																uint8_t *dst,
+																uint32_t w,
+																const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 2, dst += 4) {
+		const uint32_t p = src[0] | (src[1] << 8);
+		EXPAND_565(p)
+	}
+}
+
+static void convert_row_565_msb(const uint8_t *src,
+																uint8_t *dst,
+																uint32_t w,
+																const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 2, dst += 4) {
+		const uint32_t p = (src[0] << 8) | src[1];
+		EXPAND_565(p)
+	}
+}
+
+#undef EXPAND_565
+
+// 30-bit deep color, X2R10G10B10 in a little-endian 32-bit pixel
+static void convert_row_x2r10g10b10(const uint8_t *src,
+																		uint8_t *dst,
+																		uint32_t w,
+																		const PixelLayout *l)
+{
+	(void) l;
+	for (uint32_t x = 0; x < w; x++, src += 4, dst += 4) {
+		const uint32_t p = src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t) src[3] << 24);
+		dst[0] = (uint8_t) (p >> 2);
+		dst[1] = (uint8_t) (p >> 12);
+		dst[2] = (uint8_t) (p >> 22);
+		dst[3] = 0xFF;
+	}
+}
+
+typedef struct {
+	uint32_t bits_per_pixel;
+	bool msb_first;
+	uint32_t red_mask, green_mask, blue_mask;
+	ConvertKernel kernel;
+} ConvertKernelEntry;
+
+#define CONVERT_KERNEL(fn) {#fn, fn}
+
+static const ConvertKernelEntry convert_kernels[] = {
+	{32, false, 0xFF0000,   0x00FF00, 0x0000FF, CONVERT_KERNEL(convert_row_bgrx)},
+	{32, true,  0x0000FF,   0x00FF00, 0xFF0000, CONVERT_KERNEL(convert_row_xbgr)},
+	{32, false, 0x0000FF,   0x00FF00, 0xFF0000, CONVERT_KERNEL(convert_row_rgbx)},
+	{32, true,  0xFF0000,   0x00FF00, 0x0000FF, CONVERT_KERNEL(convert_row_xrgb)},
+	{24, false, 0xFF0000,   0x00FF00, 0x0000FF, CONVERT_KERNEL(convert_row_bgr24)},
+	{24, true,  0xFF0000,   0x00FF00, 0x0000FF, CONVERT_KERNEL(convert_row_rgb24)},
+	{24, false, 0x0000FF,   0x00FF00, 0xFF0000, CONVERT_KERNEL(convert_row_rgb24)},
+	{24, true,  0x0000FF,   0x00FF00, 0xFF0000, CONVERT_KERNEL(convert_row_bgr24)},
+	{16, false, 0xF800,     0x07E0,   0x001F,   CONVERT_KERNEL(convert_row_565_lsb)},
+	{16, true,  0xF800,     0x07E0,   0x001F,   CONVERT_KERNEL(convert_row_565_msb)},
+	{32, false, 0x3FF00000, 0x000FFC00, 0x000003FF, CONVERT_KERNEL(convert_row_x2r10g10b10)},
+};
+
+#define CONVERT_KERNELS_COUNT (sizeof(convert_kernels) / sizeof(convert_kernels[0]))
+
+static const ConvertKernel convert_kernel_generic = CONVERT_KERNEL(convert_row_generic);
+
+#undef CONVERT_KERNEL
+
+static inline ConvertKernel select_convert_kernel(const PixelLayout *l)
+{
+	for (size_t i = 0; i < CONVERT_KERNELS_COUNT; i++) {
+		const ConvertKernelEntry *e = &convert_kernels[i];
+		if (e->bits_per_pixel == l->bits_per_pixel &&
+				e->msb_first == l->msb_first &&
+				e->red_mask == l->red_mask &&
+				e->green_mask == l->green_mask &&
+				e->blue_mask == l->blue_mask) {
+			return e->kernel;
+		}
+	}
+
+	return convert_kernel_generic;
+}
+
+static inline bool pixel_layout_supported(const PixelLayout *l)
+{
+	return (l->bits_per_pixel == 16 ||
+					l->bits_per_pixel == 24 ||
+					l->bits_per_pixel == 32) &&
+		l->red.width && l->green.width && l->blue.width;
+}
+
+// Converts rows [y0, y1) of `src` (`stride` bytes apart) into BGRX rows of
+// `dst` (`dst_stride` bytes apart), both point at the start of their images.
+static inline void convert_rows(ConvertKernel kernel,
+																const PixelLayout *l,
+																const uint8_t *src, size_t stride,
+																uint8_t *dst, size_t dst_stride,
+																uint32_t w,
+																uint32_t y0, uint32_t y1)
+{
+	for (uint32_t y = y0; y < y1; y++) {
+		kernel.fn(src + y*stride, dst + y*dst_stride, w, l);
+	}
+}
+
+typedef void (*bgrx_to_rgb_fn)(const uint8_t *src, uint8_t *dst, uint32_t w);
+
+static void bgrx_to_rgb_row_scalar(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x++, src += 4, dst += 3) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+}
+
+#if CONVERT_X86
+
+#define TARGET(t) __attribute__((target(t)))
+
+// 4 BGRX pixels -> 12 RGB bytes followed by 4 zeros
+#define BGRX_SHUFFLE \
+	2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+TARGET("ssse3") static void bgrx_to_rgb_row_ssse3(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	const __m128i shuffle = _mm_setr_epi8(BGRX_SHUFFLE);
+
+	// Each step stores 16 bytes but advances by 12,
+	// so stop while the overhang still lands inside of this row
+	uint32_t x = 0;
+	for (; x + 6 <= w; x += 4) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) (src + x*4));
+		_mm_storeu_si128((__m128i *) (dst + x*3), _mm_shuffle_epi8(v, shuffle));
+	}
+
+	bgrx_to_rgb_row_scalar(src + x*4, dst + x*3, w - x);
+}
+
+TARGET("avx2") static void bgrx_to_rgb_row_avx2(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	const __m256i shuffle = _mm256_setr_epi8(BGRX_SHUFFLE, BGRX_SHUFFLE);
+
+	// 8 pixels per step, written as two overlapping 16 byte stores of 12
+	uint32_t x = 0;
+	for (; x + 10 <= w; x += 8) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *) (src + x*4));
+		const __m256i p = _mm256_shuffle_epi8(v, shuffle);
+		_mm_storeu_si128((__m128i *) (dst + x*3), _mm256_castsi256_si128(p));
+		_mm_storeu_si128((__m128i *) (dst + x*3 + 12), _mm256_extracti128_si256(p, 1));
+	}
+
+	bgrx_to_rgb_row_ssse3(src + x*4, dst + x*3, w - x);
+}
+
+#undef BGRX_SHUFFLE
+#undef TARGET
+
+#endif // CONVERT_X86
+
+// Picks the widest `bgrx_to_rgb_row` version this CPU supports
+static inline bgrx_to_rgb_fn select_bgrx_to_rgb(void)
+{
+#if CONVERT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return bgrx_to_rgb_row_avx2;
+	if (__builtin_cpu_supports("ssse3")) return bgrx_to_rgb_row_ssse3;
+#endif
+	return bgrx_to_rgb_row_scalar;
+}
+
+#endif // CONVERT_H
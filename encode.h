@@ -0,0 +1,298 @@
+/*
+  Output encoders that trade file size for speed: QOI, binary PPM and
+  24-bit BMP. Like `png_encode`, each of them takes `w`x`h` BGRX pixels,
+  `stride` bytes apart, and returns the whole file in a buffer to be
+  `free`d, or NULL when it can't be allocated.
+
+  PPM and BMP are plain copies of the pixels with a header in front, QOI
+  is the single-pass format from <https://qoiformat.org/qoi-specification.pdf>,
+  written with 3 channels since the captures have no alpha.
+
+  Being row by row, PPM and BMP can also be streamed like `png_write` does:
+  `ppm_write` and `bmp_write` convert a batch of rows at a time and hand it
+  to a write callback, so the whole file is never in memory.
+*/
+
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "convert.h"
+
+// Rows are converted and handed to the write callback this many bytes at a time
+#define ENCODE_WRITE_BATCH_BYTES (256*1024)
+
+typedef bool (*encode_write_fn)(void *ctx, const uint8_t *data, size_t size);
+
+static inline void encode_put_u32_be(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t) (v >> 24);
+	p[1] = (uint8_t) (v >> 16);
+	p[2] = (uint8_t) (v >> 8);
+	p[3] = (uint8_t) v;
+}
+
+static inline void encode_put_u32_le(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t) (v >> 8);
+	p[2] = (uint8_t) (v >> 16);
+	p[3] = (uint8_t) (v >> 24);
+}
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xC0
+#define QOI_OP_RGB   0xFE
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+static uint8_t *qoi_encode(const uint8_t *bgrx, size_t stride,
+													 uint32_t w, uint32_t h, size_t *size)
+{
+	// Every pixel takes at most 4 bytes, as QOI_OP_RGB
+	const size_t max_size = QOI_HEADER_SIZE + (size_t) w*h*4 + QOI_PADDING_SIZE;
+	uint8_t *out = (uint8_t *) malloc(max_size);
+	if (!out) return NULL;
+
+	memcpy(out, "qoif", 4);
+	encode_put_u32_be(out + 4, w);
+	encode_put_u32_be(out + 8, h);
+	out[12] = 3; // RGB
+	out[13] = 0; // sRGB with linear alpha
+
+	uint8_t *p = out + QOI_HEADER_SIZE;
+
+	// Seen colors, packed as 0xAARRGGBB with alpha always 255, so the
+	// empty slots, which are transparent black to the decoder, never match
+	uint32_t index[64] = {0};
+	uint32_t prev = 0xFF000000;
+	uint8_t prev_r = 0, prev_g = 0, prev_b = 0;
+	uint32_t run = 0;
+
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t *src = bgrx + y*stride;
+		for (uint32_t x = 0; x < w; x++, src += 4) {
+			const uint8_t r = src[2], g = src[1], b = src[0];
+			const uint32_t px = 0xFF000000 | (uint32_t) r << 16 | (uint32_t) g << 8 | b;
+
+			if (px == prev) {
+				run++;
+				if (run == 62) {
+					*p++ = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run) {
+				*p++ = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			const uint32_t hash = (r*3 + g*5 + b*7 + 255*11) % 64;
+			if (index[hash] == px) {
+				*p++ = QOI_OP_INDEX | hash;
+			} else {
+				index[hash] = px;
+
+				const int8_t dr = (int8_t) (r - prev_r);
+				const int8_t dg = (int8_t) (g - prev_g);
+				const int8_t db = (int8_t) (b - prev_b);
+				const int8_t dr_dg = (int8_t) (dr - dg);
+				const int8_t db_dg = (int8_t) (db - dg);
+
+				if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+					*p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+				} else if (dg > -33 && dg < 32 && dr_dg > -9 && dr_dg < 8 && db_dg > -9 && db_dg < 8) {
+					*p++ = QOI_OP_LUMA | (dg + 32);
+					*p++ = (uint8_t) ((dr_dg + 8) << 4 | (db_dg + 8));
+				} else {
+					*p++ = QOI_OP_RGB;
+					*p++ = r;
+					*p++ = g;
+					*p++ = b;
+				}
+			}
+
+			prev = px;
+			prev_r = r;
+			prev_g = g;
+			prev_b = b;
+		}
+	}
+
+	if (run) *p++ = QOI_OP_RUN | (run - 1);
+
+	static const uint8_t padding[QOI_PADDING_SIZE] = {0, 0, 0, 0, 0, 0, 0, 1};
+	memcpy(p, padding, sizeof(padding));
+	p += sizeof(padding);
+
+	*size = p - out;
+	return out;
+}
+
+// Rows that fit into one batch, but at least one
+static inline uint32_t encode_batch_rows(size_t row_bytes, uint32_t h)
+{
+	size_t rows = row_bytes ? ENCODE_WRITE_BATCH_BYTES / row_bytes : h;
+	if (rows < 1) rows = 1;
+	return rows < h ? (uint32_t) rows : h;
+}
+
+#define PPM_HEADER_CAP 32
+
+static int ppm_header(char header[PPM_HEADER_CAP], uint32_t w, uint32_t h)
+{
+	return snprintf(header, PPM_HEADER_CAP, "P6\n%u %u\n255\n", w, h);
+}
+
+static uint8_t *ppm_encode(const uint8_t *bgrx, size_t stride,
+													 uint32_t w, uint32_t h, size_t *size)
+{
+	char header[PPM_HEADER_CAP];
+	const int header_len = ppm_header(header, w, h);
+
+	const size_t row_bytes = (size_t) w*3;
+	*size = header_len + row_bytes*h;
+	uint8_t *out = (uint8_t *) malloc(*size);
+	if (!out) return NULL;
+
+	memcpy(out, header, header_len);
+
+	const bgrx_to_rgb_fn to_rgb = select_bgrx_to_rgb();
+	for (uint32_t y = 0; y < h; y++) {
+		to_rgb(bgrx + y*stride, out + header_len + y*row_bytes, w);
+	}
+
+	return out;
+}
+
+// Same as `ppm_encode`, but hands the file to `write` a batch of rows at a time
+static bool ppm_write(const uint8_t *bgrx, size_t stride,
+											uint32_t w, uint32_t h,
+											encode_write_fn write, void *write_ctx)
+{
+	char header[PPM_HEADER_CAP];
+	const int header_len = ppm_header(header, w, h);
+	if (!write(write_ctx, (const uint8_t *) header, header_len)) return false;
+	if (!w || !h) return true;
+
+	const size_t row_bytes = (size_t) w*3;
+	const uint32_t batch_rows = encode_batch_rows(row_bytes, h);
+	uint8_t *batch = (uint8_t *) malloc(batch_rows*row_bytes);
+	if (!batch) return false;
+
+	const bgrx_to_rgb_fn to_rgb = select_bgrx_to_rgb();
+	bool ok = true;
+	for (uint32_t y = 0; ok && y < h; y += batch_rows) {
+		const uint32_t rows = h - y < batch_rows ? h - y : batch_rows;
+		for (uint32_t i = 0; i < rows; i++) {
+			to_rgb(bgrx + (y + i)*stride, batch + i*row_bytes, w);
+		}
+		ok = write(write_ctx, batch, rows*row_bytes);
+	}
+
+	free(batch);
+	return ok;
+}
+
+#define BMP_HEADER_SIZE (14 + 40)
+
+static inline size_t bmp_row_bytes(uint32_t w)
+{
+	return ((size_t) w*3 + 3) & ~(size_t) 3;
+}
+
+static void bmp_header(uint8_t out[BMP_HEADER_SIZE], uint32_t w, uint32_t h)
+{
+	const size_t pixels_size = bmp_row_bytes(w)*h;
+	memset(out, 0, BMP_HEADER_SIZE);
+
+	// BITMAPFILEHEADER
+	out[0] = 'B';
+	out[1] = 'M';
+	encode_put_u32_le(out + 2, (uint32_t) (BMP_HEADER_SIZE + pixels_size));
+	encode_put_u32_le(out + 10, BMP_HEADER_SIZE);
+
+	// BITMAPINFOHEADER, uncompressed, without a palette
+	encode_put_u32_le(out + 14, 40);
+	encode_put_u32_le(out + 18, w);
+	encode_put_u32_le(out + 22, h);
+	out[26] = 1;  // planes
+	out[28] = 24; // bits per pixel
+	encode_put_u32_le(out + 34, (uint32_t) pixels_size);
+}
+
+// Row `y` of the file, which is row `h - 1 - y` of the image. The padding
+// at the end of `dst` is left as it is
+static inline void bmp_row(const uint8_t *bgrx, size_t stride,
+													 uint32_t w, uint32_t h, uint32_t y, uint8_t *dst)
+{
+	const uint8_t *src = bgrx + (h - 1 - y)*stride;
+	for (uint32_t x = 0; x < w; x++, src += 4, dst += 3) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+	}
+}
+
+// Bottom-up rows of 24-bit BGR, which is what every BMP reader takes
+static uint8_t *bmp_encode(const uint8_t *bgrx, size_t stride,
+													 uint32_t w, uint32_t h, size_t *size)
+{
+	const size_t row_bytes = bmp_row_bytes(w);
+	const size_t pixels_size = row_bytes*h;
+	if (BMP_HEADER_SIZE + pixels_size > UINT32_MAX) return NULL;
+
+	*size = BMP_HEADER_SIZE + pixels_size;
+	uint8_t *out = (uint8_t *) calloc(1, *size);
+	if (!out) return NULL;
+
+	bmp_header(out, w, h);
+	for (uint32_t y = 0; y < h; y++) {
+		bmp_row(bgrx, stride, w, h, y, out + BMP_HEADER_SIZE + y*row_bytes);
+	}
+
+	return out;
+}
+
+// Same as `bmp_encode`, but hands the file to `write` a batch of rows at a time
+static bool bmp_write(const uint8_t *bgrx, size_t stride,
+											uint32_t w, uint32_t h,
+											encode_write_fn write, void *write_ctx)
+{
+	const size_t row_bytes = bmp_row_bytes(w);
+	if (BMP_HEADER_SIZE + row_bytes*h > UINT32_MAX) return false;
+
+	uint8_t header[BMP_HEADER_SIZE];
+	bmp_header(header, w, h);
+	if (!write(write_ctx, header, BMP_HEADER_SIZE)) return false;
+	if (!w || !h) return true;
+
+	// Zeroed once, so the padding of every row stays zero
+	const uint32_t batch_rows = encode_batch_rows(row_bytes, h);
+	uint8_t *batch = (uint8_t *) calloc(batch_rows, row_bytes);
+	if (!batch) return false;
+
+	bool ok = true;
+	for (uint32_t y = 0; ok && y < h; y += batch_rows) {
+		const uint32_t rows = h - y < batch_rows ? h - y : batch_rows;
+		for (uint32_t i = 0; i < rows; i++) {
+			bmp_row(bgrx, stride, w, h, y + i, batch + i*row_bytes);
+		}
+		ok = write(write_ctx, batch, rows*row_bytes);
+	}
+
+	free(batch);
+	return ok;
+}
+
+#endif // ENCODE_H
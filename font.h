@@ -16,6 +16,13 @@
 // LICENSE: Under the SIL Open Font License, Version 1.1.										          //
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// Atlas dimensions and format, shared with font_atlas_gen
+#define FONT_ATLAS_WIDTH 256
+#define FONT_ATLAS_HEIGHT 256
+#define FONT_ATLAS_FORMAT PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA
+
+#ifdef FONT_ATLAS_GENERATOR
+
 #define COMPRESSED_DATA_SIZE_FONT_FONT 7221
 
 // Font image pixels data compressed (DEFLATE)
@@ -383,6 +390,11 @@ static unsigned char fontData_Font[COMPRESSED_DATA_SIZE_FONT_FONT] = { 0xed,
     0x28, 0x8a, 0xa2, 0x28, 0x8a, 0xa2, 0x28, 0x8a, 0xa2, 0x28, 0x8a, 0xa2, 0x28, 0x8a, 0xa2, 0x28, 0x8a, 0xa2, 0x28, 0x8a,
     0xa2, 0x28, 0x8a, 0xa2, 0x28, 0x8a, 0x72, 0xb8, 0x28, 0xfc, 0xa7, 0xed, 0xa0, 0xfa, 0x2b, 0x7f, 0x59, 0xfd, 0xff, 0x1f };
 
+#else
+
+// Raw atlas pixels, inflated from the data above by `make font_atlas.h`
+#include "font_atlas.h"
+
 // Font characters rectangles data
 static Rectangle fontRecs_Font[95] = {
     { 4, 4, 8 , 20 },
@@ -592,14 +604,12 @@ static Font LoadFont_Font(void)
     font.glyphPadding = 4;
 
     // Custom font loading
-    // NOTE: Compressed font image data (DEFLATE), it requires DecompressData() function
-    int fontDataSize_Font = 0;
-    unsigned char *data = DecompressData(fontData_Font, COMPRESSED_DATA_SIZE_FONT_FONT, &fontDataSize_Font);
-    Image imFont = { data, 256, 256, 1, 2 };
+    // NOTE: Atlas pixels are embedded uncompressed, so they're uploaded as is
+    Image imFont = { (void *) fontAtlas_Font, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 1, FONT_ATLAS_FORMAT };
 
     // Load texture from image
+    // WARNING: Image data is static, it must not be unloaded
     font.texture = LoadTextureFromImage(imFont);
-    UnloadImage(imFont);  // Uncompressed data can be unloaded from memory
 
     // Assign glyph recs and info data directly
     // WARNING: This font data must not be unloaded
@@ -608,3 +618,5 @@ static Font LoadFont_Font(void)
 
     return font;
 }
+
+#endif // FONT_ATLAS_GENERATOR
@@ -0,0 +1,59 @@
+/*
+  Build-time generator of font_atlas.h: inflates the DEFLATE-compressed
+  atlas from font.h and writes it out as raw pixels, so that `ss` can
+  upload them without decompressing anything on startup.
+
+  Usage: font_atlas_gen <output header>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <raylib.h>
+
+#define FONT_ATLAS_GENERATOR
+#include "font.h"
+
+#define BYTES_PER_LINE 20
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <output header>\n", argv[0]);
+		return 1;
+	}
+
+	// raylib logs to stdout, keep it quiet
+	SetTraceLogLevel(LOG_NONE);
+
+	int size = 0;
+	unsigned char *data = DecompressData(fontData_Font, COMPRESSED_DATA_SIZE_FONT_FONT, &size);
+
+	const int expected_size = GetPixelDataSize(FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, FONT_ATLAS_FORMAT);
+	if (data == NULL || size != expected_size) {
+		fprintf(stderr, "font atlas inflated to %d bytes, expected %d\n", size, expected_size);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[1], "w");
+	if (f == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	fprintf(f, "// Generated by font_atlas_gen from the compressed atlas in font.h, don't edit\n\n");
+	fprintf(f, "static const unsigned char fontAtlas_Font[%d] = {", size);
+	for (int i = 0; i < size; i++) {
+		fprintf(f, "%s0x%02x,", i % BYTES_PER_LINE == 0 ? "\n    " : " ", data[i]);
+	}
+	fprintf(f, "\n};\n");
+
+	MemFree(data);
+
+	if (fclose(f) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	return 0;
+}
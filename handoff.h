@@ -0,0 +1,158 @@
+/*
+  Raw frame handoff to local processes: the pixels are put in a sealed
+  memfd, which is passed over a Unix stream socket with SCM_RIGHTS, along
+  with a `HandoffHeader` describing them as the message itself. The seals
+  make sure that the receiver can mmap the frame read-only and trust that
+  it never shrinks or changes under it.
+
+  A receiver listens on the socket and, for every connection, reads one
+  header with `recvmsg`, takes the descriptor out of the control message
+  and maps `size` bytes of it.
+
+  Needs _GNU_SOURCE for `memfd_create` and the file seals.
+*/
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#define HANDOFF_MAGIC 0x46525353u // "SSRF" in memory
+#define HANDOFF_VERSION 1
+
+// DRM fourcc 'XR24', bytes are B, G, R and padding in memory
+#define HANDOFF_FORMAT_XRGB8888 0x34325258u
+
+// All fields are in host byte order, the receiver is on the same machine
+typedef struct {
+	uint32_t magic, version;
+	uint32_t width, height, stride, format;
+	uint64_t size;
+} HandoffHeader;
+
+typedef struct {
+	int fd;
+	uint8_t *pixels;
+	uint32_t w, h, stride;
+	size_t size;
+} HandoffFrame;
+
+// Creates a writable `w`x`h` frame of BGRX rows, `frame->stride` bytes apart
+static bool handoff_frame_create(HandoffFrame *frame, uint32_t w, uint32_t h)
+{
+	*frame = (HandoffFrame) {
+		.fd = -1,
+		.w = w,
+		.h = h,
+		.stride = w*4,
+		.size = (size_t) w*4*h
+	};
+
+	frame->fd = memfd_create("ss-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (frame->fd < 0) return false;
+
+	if (ftruncate(frame->fd, frame->size) != 0) {
+		close(frame->fd);
+		return false;
+	}
+
+	void *pixels = mmap(NULL, frame->size, PROT_READ | PROT_WRITE, MAP_SHARED, frame->fd, 0);
+	if (pixels == MAP_FAILED) {
+		close(frame->fd);
+		return false;
+	}
+
+	frame->pixels = (uint8_t *) pixels;
+	return true;
+}
+
+static void handoff_frame_discard(HandoffFrame *frame)
+{
+	if (frame->pixels) munmap(frame->pixels, frame->size);
+	if (frame->fd >= 0) close(frame->fd);
+	frame->pixels = NULL;
+	frame->fd = -1;
+}
+
+// Seals the frame and passes it to whoever listens at `socket_path`,
+// the frame is gone afterwards either way
+static bool handoff_frame_send(HandoffFrame *frame, const char *socket_path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	const size_t path_len = strlen(socket_path);
+
+	// A cut path could name some other socket
+	if (path_len >= sizeof(addr.sun_path)) {
+		handoff_frame_discard(frame);
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	memcpy(addr.sun_path, socket_path, path_len + 1);
+
+	// Sealing against writes fails while a writable mapping is left
+	munmap(frame->pixels, frame->size);
+	frame->pixels = NULL;
+
+	bool sent = false;
+	const int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+	const int sock = fcntl(frame->fd, F_ADD_SEALS, seals) == 0
+		? socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)
+		: -1;
+
+	if (sock >= 0 && connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+		HandoffHeader header = {
+			.magic = HANDOFF_MAGIC,
+			.version = HANDOFF_VERSION,
+			.width = frame->w,
+			.height = frame->h,
+			.stride = frame->stride,
+			.format = HANDOFF_FORMAT_XRGB8888,
+			.size = frame->size
+		};
+
+		struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+
+		union {
+			char buf[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr align;
+		} control;
+		memset(&control, 0, sizeof(control));
+
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buf,
+			.msg_controllen = sizeof(control.buf)
+		};
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &frame->fd, sizeof(int));
+
+		ssize_t n;
+		do {
+			n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+		} while (n < 0 && errno == EINTR);
+		sent = n == (ssize_t) sizeof(header);
+	}
+
+	// Keeps `errno` of whatever failed for the caller to report
+	const int saved_errno = errno;
+	if (sock >= 0) close(sock);
+	handoff_frame_discard(frame);
+	errno = saved_errno;
+
+	return sent;
+}
+
+#endif // HANDOFF_H
@@ -0,0 +1,568 @@
+/*
+  Streaming PNG writer for BGRX images that deflates bands of scanlines on
+  several threads at once.
+
+  The caller fills bands of rows one after another with `png_stream_next`
+  and `png_stream_submit`, while workers convert every submitted band to
+  RGB, filter and deflate it on its own, pigz style: every band but the
+  last ends with a sync flush, so their raw deflate streams concatenate
+  into one valid stream. Finished bands are handed to the write callback
+  in order, each as an IDAT chunk of its own, by whichever worker finished
+  the band that was next in line. The Adler-32 of the whole stream is
+  combined from the per-band ones and goes into a final IDAT chunk. Bands
+  don't share a dictionary, which costs a few bytes at every boundary.
+
+  Only a fixed number of bands is in flight at once, so memory stays bounded
+  no matter how big the image is. `png_write` does the same for an image
+  that is already in memory, and `png_encode` returns it as a whole.
+
+  Rows get whichever of the five PNG filters gives the smallest sum of
+  absolute differences, like stb_image_write picks them, so the decoded
+  pixels are the same as with raylib's `ExportImage`.
+*/
+
+#ifndef PNG_H
+#define PNG_H
+
+#include <zlib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "convert.h"
+
+// Bands thinner than this are not worth a deflate stream of their own
+#define PNG_MIN_BAND_BYTES (256*1024)
+
+#define PNG_DEFAULT_LEVEL 6
+
+// Bands in flight on top of one per worker, one being filled by the caller
+// and one waiting for its turn to be written
+#define PNG_STREAM_EXTRA_SLOTS 2
+
+// Chunk length and type in front of the data, CRC after it
+#define PNG_CHUNK_OVERHEAD 12
+
+typedef bool (*png_write_fn)(void *ctx, const uint8_t *data, size_t size);
+
+enum {
+	PNG_SLOT_FREE,
+	PNG_SLOT_FILLING,
+	PNG_SLOT_QUEUED,
+	PNG_SLOT_DEFLATING,
+	PNG_SLOT_DONE
+};
+
+typedef struct {
+	// The last row of the band above, then the band's own rows
+	uint8_t *bgrx;
+	// The whole IDAT chunk of the band once it's deflated
+	uint8_t *chunk;
+	size_t chunk_size;
+	uint32_t band, rows;
+	uLong adler;
+	size_t filtered_size;
+	int state;
+	bool failed;
+} PngSlot;
+
+typedef struct {
+	uint32_t w, h, band_rows, bands_count;
+	size_t stride, chunk_cap;
+	int level;
+
+	png_write_fn write;
+	void *write_ctx;
+
+	PngSlot *slots;
+	uint32_t slots_count;
+	pthread_t *workers;
+	uint32_t workers_count;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t queued_cond, freed_cond;
+	// Bands handed out to the caller, submitted by it, and written so far
+	uint32_t next_fill, submitted, written;
+	bool writing, failed, quit;
+	uLong adler;
+} PngStream;
+
+static inline uint8_t png_paeth(int a, int b, int c)
+{
+	const int p = a + b - c;
+	const int pa = abs(p - a);
+	const int pb = abs(p - b);
+	const int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return (uint8_t) a;
+	if (pb <= pc) return (uint8_t) b;
+	return (uint8_t) c;
+}
+
+// Applies `filter` to `cur` into `dst` and returns the sum of absolute
+// values of the result, `prev` is NULL for the first row. Every filter has
+// a loop of its own, so none of them branches per byte.
+static uint32_t png_filter_row(int filter, const uint8_t *prev, const uint8_t *cur,
+															 uint8_t *dst, uint32_t n)
+{
+	const uint32_t bpp = 3;
+	uint32_t cost = 0;
+
+#define PNG_FILTER_LOOP(first, rest) do { \
+		uint32_t i = 0; \
+		for (; i < bpp && i < n; i++) { \
+			dst[i] = (uint8_t) (first); \
+			cost += (uint32_t) abs((int8_t) dst[i]); \
+		} \
+		for (; i < n; i++) { \
+			dst[i] = (uint8_t) (rest); \
+			cost += (uint32_t) abs((int8_t) dst[i]); \
+		} \
+	} while (0)
+
+	if (!prev) {
+		switch (filter) {
+		case 0: PNG_FILTER_LOOP(cur[i], cur[i]); break;
+		case 1: PNG_FILTER_LOOP(cur[i], cur[i] - cur[i - bpp]); break;
+		case 2: PNG_FILTER_LOOP(cur[i], cur[i]); break;
+		case 3: PNG_FILTER_LOOP(cur[i], cur[i] - (cur[i - bpp] >> 1)); break;
+		case 4: PNG_FILTER_LOOP(cur[i], cur[i] - cur[i - bpp]); break;
+		}
+	} else {
+		switch (filter) {
+		case 0: PNG_FILTER_LOOP(cur[i], cur[i]); break;
+		case 1: PNG_FILTER_LOOP(cur[i], cur[i] - cur[i - bpp]); break;
+		case 2: PNG_FILTER_LOOP(cur[i] - prev[i], cur[i] - prev[i]); break;
+		case 3: PNG_FILTER_LOOP(cur[i] - (prev[i] >> 1),
+														cur[i] - ((cur[i - bpp] + prev[i]) >> 1)); break;
+		case 4: PNG_FILTER_LOOP(cur[i] - prev[i],
+														cur[i] - png_paeth(cur[i - bpp], prev[i], prev[i - bpp])); break;
+		}
+	}
+
+#undef PNG_FILTER_LOOP
+
+	return cost;
+}
+
+// Filters one row into `dst`, which starts with the filter type byte,
+// `candidate` is scratch space of `n` bytes
+static void png_filter_best(const uint8_t *prev, const uint8_t *cur,
+														uint8_t *dst, uint8_t *candidate, uint32_t n)
+{
+	// The best result so far and the one being tried swap places,
+	// so only a final copy is needed when the best one is not in `dst`
+	uint8_t *best = dst + 1;
+	uint8_t *trial = candidate;
+	uint32_t best_cost = png_filter_row(0, prev, cur, best, n);
+	dst[0] = 0;
+
+	for (int filter = 1; filter < 5; filter++) {
+		const uint32_t cost = png_filter_row(filter, prev, cur, trial, n);
+		if (cost < best_cost) {
+			best_cost = cost;
+			dst[0] = (uint8_t) filter;
+			uint8_t *tmp = best;
+			best = trial;
+			trial = tmp;
+		}
+	}
+
+	if (best != dst + 1) memcpy(dst + 1, best, n);
+}
+
+static inline void png_put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t) (v >> 24);
+	p[1] = (uint8_t) (v >> 16);
+	p[2] = (uint8_t) (v >> 8);
+	p[3] = (uint8_t) v;
+}
+
+// Fills in the length, type and CRC around `len` bytes of data at `chunk + 8`
+static void png_frame_chunk(uint8_t *chunk, const char *type, uint32_t len)
+{
+	png_put_u32(chunk, len);
+	memcpy(chunk + 4, type, 4);
+	png_put_u32(chunk + 8 + len, (uint32_t) crc32(0, chunk + 4, 4 + len));
+}
+
+static bool png_write_chunk(PngStream *s, const char *type, const uint8_t *data, uint32_t len)
+{
+	uint8_t chunk[PNG_CHUNK_OVERHEAD + 13];
+	if (len) memcpy(chunk + 8, data, len);
+	png_frame_chunk(chunk, type, len);
+	return s->write(s->write_ctx, chunk, PNG_CHUNK_OVERHEAD + len);
+}
+
+// Filters and deflates the band in `slot` into its IDAT chunk,
+// `rgb` holds 3 rows and `filtered` a whole band of filtered rows
+static void png_deflate_band(PngStream *s, PngSlot *slot, z_stream *zs,
+														 uint8_t *rgb, uint8_t *filtered)
+{
+	const bgrx_to_rgb_fn to_rgb = select_bgrx_to_rgb();
+	const uint32_t row_bytes = s->w*3;
+
+	uint8_t *prev = rgb, *cur = rgb + row_bytes, *candidate = rgb + row_bytes*2;
+	if (slot->band > 0) to_rgb(slot->bgrx, prev, s->w);
+
+	for (uint32_t y = 0; y < slot->rows; y++) {
+		to_rgb(slot->bgrx + (y + 1)*s->stride, cur, s->w);
+		png_filter_best(slot->band > 0 || y > 0 ? prev : NULL, cur,
+										filtered + (size_t) y*(1 + row_bytes),
+										candidate, row_bytes);
+
+		uint8_t *tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	slot->filtered_size = (size_t) slot->rows*(1 + row_bytes);
+	slot->adler = adler32(adler32(0, NULL, 0), filtered, slot->filtered_size);
+
+	// The zlib header goes in front of the first band
+	uint8_t *data = slot->chunk + 8;
+	size_t header_size = 0;
+	if (slot->band == 0) {
+		const uint8_t cmf = 0x78;
+		uint8_t flg = (s->level < 2 ? 0 : s->level < 6 ? 1 : s->level == 6 ? 2 : 3) << 6;
+		flg += 31 - (cmf*256 + flg) % 31;
+		data[0] = cmf;
+		data[1] = flg;
+		header_size = 2;
+	}
+
+	const bool last = slot->band == s->bands_count - 1;
+	deflateReset(zs);
+	zs->next_in = filtered;
+	zs->avail_in = slot->filtered_size;
+	zs->next_out = data + header_size;
+	zs->avail_out = s->chunk_cap - PNG_CHUNK_OVERHEAD - header_size;
+
+	const int ret = deflate(zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+	slot->failed = zs->avail_in != 0 || (last ? ret != Z_STREAM_END : ret != Z_OK);
+
+	const uint32_t len = (uint32_t) (header_size + zs->total_out);
+	png_frame_chunk(slot->chunk, "IDAT", len);
+	slot->chunk_size = PNG_CHUNK_OVERHEAD + len;
+}
+
+// Writes out every finished band that is next in line, called with the
+// mutex held by whichever worker just finished one. Only one of them
+// writes at a time, the others leave their bands to it.
+static void png_write_done_bands(PngStream *s)
+{
+	if (s->writing) return;
+	s->writing = true;
+
+	for (;;) {
+		PngSlot *slot = &s->slots[s->written % s->slots_count];
+		if (s->written >= s->submitted || slot->state != PNG_SLOT_DONE || slot->band != s->written) break;
+
+		bool ok = !s->failed && !slot->failed;
+		pthread_mutex_unlock(&s->mutex);
+
+		if (ok) ok = s->write(s->write_ctx, slot->chunk, slot->chunk_size);
+		s->adler = adler32_combine(s->adler, slot->adler, slot->filtered_size);
+
+		pthread_mutex_lock(&s->mutex);
+		if (!ok) s->failed = true;
+		slot->state = PNG_SLOT_FREE;
+		s->written++;
+		pthread_cond_broadcast(&s->freed_cond);
+	}
+
+	s->writing = false;
+}
+
+static void *png_stream_worker(void *arg)
+{
+	PngStream *s = (PngStream *) arg;
+	const uint32_t row_bytes = s->w*3;
+
+	uint8_t *rgb = (uint8_t *) malloc((size_t) row_bytes*3);
+	uint8_t *filtered = (uint8_t *) malloc((size_t) s->band_rows*(1 + row_bytes));
+
+	z_stream zs = {0};
+	const bool ready = rgb && filtered &&
+		deflateInit2(&zs, s->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+	pthread_mutex_lock(&s->mutex);
+	for (;;) {
+		// Bands are taken in order, the oldest queued one first
+		PngSlot *slot = NULL;
+		for (uint32_t i = s->written; i < s->submitted; i++) {
+			PngSlot *candidate = &s->slots[i % s->slots_count];
+			if (candidate->state == PNG_SLOT_QUEUED) {
+				slot = candidate;
+				break;
+			}
+		}
+
+		if (!slot) {
+			if (s->quit) break;
+			pthread_cond_wait(&s->queued_cond, &s->mutex);
+			continue;
+		}
+
+		slot->state = PNG_SLOT_DEFLATING;
+		pthread_mutex_unlock(&s->mutex);
+
+		if (ready) {
+			png_deflate_band(s, slot, &zs, rgb, filtered);
+		} else {
+			slot->failed = true;
+		}
+
+		pthread_mutex_lock(&s->mutex);
+		slot->state = PNG_SLOT_DONE;
+		png_write_done_bands(s);
+	}
+	pthread_mutex_unlock(&s->mutex);
+
+	if (ready) deflateEnd(&zs);
+	free(rgb);
+	free(filtered);
+	return NULL;
+}
+
+static void png_stream_free(PngStream *s)
+{
+	if (s->workers) {
+		pthread_mutex_lock(&s->mutex);
+		s->quit = true;
+		pthread_cond_broadcast(&s->queued_cond);
+		pthread_mutex_unlock(&s->mutex);
+
+		for (uint32_t i = 0; i < s->workers_count; i++) {
+			pthread_join(s->workers[i], NULL);
+		}
+		free(s->workers);
+	}
+
+	if (s->slots) {
+		for (uint32_t i = 0; i < s->slots_count; i++) {
+			free(s->slots[i].bgrx);
+			free(s->slots[i].chunk);
+		}
+		free(s->slots);
+	}
+
+	pthread_mutex_destroy(&s->mutex);
+	pthread_cond_destroy(&s->queued_cond);
+	pthread_cond_destroy(&s->freed_cond);
+}
+
+// Starts a `w`x`h` 8-bit RGB image that comes in bands of `band_rows`,
+// deflated at zlib's `level` (0-9) by `threads` workers, and writes its
+// header right away. Returns false if it can't, with nothing left to free.
+static bool png_stream_begin(PngStream *s, uint32_t w, uint32_t h,
+														 uint32_t band_rows, int level, uint32_t threads,
+														 png_write_fn write, void *write_ctx)
+{
+	*s = (PngStream) {
+		.w = w,
+		.h = h,
+		.band_rows = band_rows ? band_rows : 1,
+		.stride = (size_t) w*4,
+		.level = level,
+		.write = write,
+		.write_ctx = write_ctx,
+		.slots_count = (threads ? threads : 1) + PNG_STREAM_EXTRA_SLOTS,
+		.adler = adler32(0, NULL, 0)
+	};
+	s->bands_count = (h + s->band_rows - 1) / s->band_rows;
+
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->queued_cond, NULL);
+	pthread_cond_init(&s->freed_cond, NULL);
+
+	// The zlib header and the sync flush's empty stored block
+	// come on top of what deflateBound counts
+	const size_t filtered_size = (size_t) s->band_rows*(1 + w*3);
+	s->chunk_cap = PNG_CHUNK_OVERHEAD + 2 + deflateBound(NULL, filtered_size) + 16;
+	if (s->chunk_cap - PNG_CHUNK_OVERHEAD > 0x7FFFFFFF) {
+		png_stream_free(s);
+		return false;
+	}
+
+	s->slots = (PngSlot *) calloc(s->slots_count, sizeof(PngSlot));
+	bool ok = s->slots != NULL;
+	for (uint32_t i = 0; ok && i < s->slots_count; i++) {
+		s->slots[i].bgrx = (uint8_t *) malloc((s->band_rows + 1)*s->stride);
+		s->slots[i].chunk = (uint8_t *) malloc(s->chunk_cap);
+		ok = s->slots[i].bgrx && s->slots[i].chunk;
+	}
+
+	const uint32_t workers_count = threads ? threads : 1;
+	s->workers = ok ? (pthread_t *) malloc(workers_count*sizeof(pthread_t)) : NULL;
+	for (uint32_t i = 0; s->workers && i < workers_count; i++) {
+		if (pthread_create(&s->workers[i], NULL, png_stream_worker, s) != 0) break;
+		s->workers_count++;
+	}
+
+	if (!ok || s->workers_count == 0) {
+		png_stream_free(s);
+		return false;
+	}
+
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	uint8_t ihdr[13];
+	png_put_u32(ihdr, w);
+	png_put_u32(ihdr + 4, h);
+	ihdr[8] = 8;  // bits per channel
+	ihdr[9] = 2;  // RGB
+	ihdr[10] = 0; // deflate
+	ihdr[11] = 0; // adaptive filtering
+	ihdr[12] = 0; // not interlaced
+
+	if (!write(write_ctx, signature, sizeof(signature)) ||
+			!png_write_chunk(s, "IHDR", ihdr, sizeof(ihdr))) {
+		png_stream_free(s);
+		return false;
+	}
+
+	return true;
+}
+
+// Waits for room for the next band and returns where its BGRX rows go,
+// `stride` bytes apart with `stride` being 4 bytes per pixel, and how many
+// of them there are in `rows`. Returns NULL once every band was handed out.
+static uint8_t *png_stream_next(PngStream *s, uint32_t *rows)
+{
+	if (s->next_fill >= s->bands_count) return NULL;
+
+	PngSlot *slot = &s->slots[s->next_fill % s->slots_count];
+
+	pthread_mutex_lock(&s->mutex);
+	while (slot->state != PNG_SLOT_FREE) {
+		pthread_cond_wait(&s->freed_cond, &s->mutex);
+	}
+	slot->state = PNG_SLOT_FILLING;
+	pthread_mutex_unlock(&s->mutex);
+
+	slot->band = s->next_fill;
+	slot->rows = s->next_fill == s->bands_count - 1
+		? s->h - s->next_fill*s->band_rows
+		: s->band_rows;
+	slot->failed = false;
+
+	*rows = slot->rows;
+	return slot->bgrx + s->stride;
+}
+
+// Queues the band returned by the last `png_stream_next` for deflating
+static void png_stream_submit(PngStream *s)
+{
+	PngSlot *slot = &s->slots[s->next_fill % s->slots_count];
+
+	// Filtering looks at the row above, the band above still has it, as
+	// its slot can't be handed out again before this one is submitted
+	if (slot->band > 0) {
+		const PngSlot *above = &s->slots[(s->next_fill - 1) % s->slots_count];
+		memcpy(slot->bgrx, above->bgrx + above->rows*s->stride, s->stride);
+	}
+
+	pthread_mutex_lock(&s->mutex);
+	slot->state = PNG_SLOT_QUEUED;
+	s->next_fill++;
+	s->submitted++;
+	pthread_cond_signal(&s->queued_cond);
+	pthread_mutex_unlock(&s->mutex);
+}
+
+// Waits for every band to be written, finishes the file and frees `s`,
+// returns false if anything failed along the way
+static bool png_stream_end(PngStream *s)
+{
+	pthread_mutex_lock(&s->mutex);
+	while (s->written < s->submitted) {
+		pthread_cond_wait(&s->freed_cond, &s->mutex);
+	}
+	bool ok = !s->failed && s->written == s->bands_count;
+	pthread_mutex_unlock(&s->mutex);
+
+	if (ok) {
+		uint8_t adler[4];
+		png_put_u32(adler, (uint32_t) s->adler);
+		ok = png_write_chunk(s, "IDAT", adler, sizeof(adler)) &&
+			png_write_chunk(s, "IEND", NULL, 0);
+	}
+
+	png_stream_free(s);
+	return ok;
+}
+
+typedef struct {
+	uint8_t *data;
+	size_t size, capacity;
+} PngBuffer;
+
+static bool png_buffer_write(void *ctx, const uint8_t *data, size_t size)
+{
+	PngBuffer *buffer = (PngBuffer *) ctx;
+	if (buffer->size + size > buffer->capacity) {
+		size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+		while (buffer->size + size > capacity) capacity *= 2;
+
+		uint8_t *data = (uint8_t *) realloc(buffer->data, capacity);
+		if (!data) return false;
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+	return true;
+}
+
+// Encodes `w`x`h` BGRX pixels, `stride` bytes apart, as a PNG of 8-bit RGB
+// and hands it to `write` piece by piece as it's deflated, so the whole file
+// is never in memory. `level` is the zlib one (0-9) and bands are deflated
+// by `threads` workers. Returns false if encoding or writing failed.
+static bool png_write(const uint8_t *bgrx, size_t stride,
+											uint32_t w, uint32_t h, int level, uint32_t threads,
+											png_write_fn write, void *write_ctx)
+{
+	const uint32_t row_bytes = w*3;
+	threads = threads ? threads : 1;
+
+	// A few bands per thread to even out the load, but not too thin ones
+	const uint32_t min_rows = (PNG_MIN_BAND_BYTES + row_bytes) / (row_bytes + 1);
+	const uint32_t even_rows = (h + threads*4 - 1) / (threads*4);
+	const uint32_t band_rows = even_rows > min_rows ? even_rows : min_rows;
+
+	PngStream s;
+	if (!png_stream_begin(&s, w, h, band_rows, level, threads, write, write_ctx)) {
+		return false;
+	}
+
+	uint32_t y = 0, rows;
+	for (uint8_t *dst; (dst = png_stream_next(&s, &rows)); y += rows) {
+		for (uint32_t i = 0; i < rows; i++) {
+			memcpy(dst + i*s.stride, bgrx + (y + i)*stride, s.stride);
+		}
+		png_stream_submit(&s);
+	}
+
+	return png_stream_end(&s);
+}
+
+// Same as `png_write`, but returns the whole file, or NULL on failure
+static uint8_t *png_encode(const uint8_t *bgrx, size_t stride,
+													 uint32_t w, uint32_t h, int level,
+													 uint32_t threads, size_t *size)
+{
+	PngBuffer buffer = {0};
+	if (!png_write(bgrx, stride, w, h, level, threads, png_buffer_write, &buffer)) {
+		free(buffer.data);
+		return NULL;
+	}
+
+	*size = buffer.size;
+	return buffer.data;
+}
+
+#endif // PNG_H
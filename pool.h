@@ -0,0 +1,143 @@
+/*
+  Minimal fixed-size thread pool for splitting work into independent tasks.
+
+  `pool_run` hands out task indices [0, count) to the workers and to the
+  calling thread itself, and returns once every task is done. Tasks must
+  write to disjoint memory, so the result never depends on how many threads
+  there are or which of them ran what.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef void (*pool_task_fn)(void *ctx, uint32_t task);
+
+typedef struct {
+	pthread_t *workers;
+	uint32_t workers_count;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+
+	pool_task_fn fn;
+	void *ctx;
+	uint32_t next_task, tasks_count, tasks_done;
+
+	bool quit;
+} ThreadPool;
+
+static inline uint32_t pool_default_threads_count(void)
+{
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (uint32_t) n : 1;
+}
+
+// Takes the next task under the lock and runs it,
+// returns false if there is nothing left to take
+static bool pool_run_one(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->next_task >= pool->tasks_count) {
+		pthread_mutex_unlock(&pool->mutex);
+		return false;
+	}
+
+	const uint32_t task = pool->next_task++;
+	const pool_task_fn fn = pool->fn;
+	void *ctx = pool->ctx;
+	pthread_mutex_unlock(&pool->mutex);
+
+	fn(ctx, task);
+
+	pthread_mutex_lock(&pool->mutex);
+	if (++pool->tasks_done == pool->tasks_count) {
+		pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return true;
+}
+
+static void *pool_worker(void *arg)
+{
+	ThreadPool *pool = (ThreadPool *) arg;
+	for (;;) {
+		pthread_mutex_lock(&pool->mutex);
+		while (!pool->quit && pool->next_task >= pool->tasks_count) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		}
+
+		if (pool->quit) {
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		while (pool_run_one(pool));
+	}
+}
+
+// `threads_count` includes the thread calling `pool_run`
+static void pool_init(ThreadPool *pool, uint32_t threads_count)
+{
+	*pool = (ThreadPool) {0};
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	if (threads_count <= 1) return;
+
+	pool->workers = (pthread_t *) malloc((threads_count - 1)*sizeof(pthread_t));
+	for (uint32_t i = 0; i < threads_count - 1; i++) {
+		if (pthread_create(&pool->workers[i], NULL, pool_worker, pool) != 0) break;
+		pool->workers_count++;
+	}
+}
+
+static void pool_run(ThreadPool *pool, pool_task_fn fn, void *ctx, uint32_t count)
+{
+	if (count == 0) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->next_task = 0;
+	pool->tasks_done = 0;
+	pool->tasks_count = count;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	while (pool_run_one(pool));
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->tasks_done < pool->tasks_count) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void pool_deinit(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (uint32_t i = 0; i < pool->workers_count; i++) {
+		pthread_join(pool->workers[i], NULL);
+	}
+
+	free(pool->workers);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	*pool = (ThreadPool) {0};
+}
+
+#endif // POOL_H
@@ -1,20 +1,48 @@
+#define _GNU_SOURCE
+
 #include <time.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <strings.h>
 #include <stdbool.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#ifndef GL_TEXTURE_SWIZZLE_RGBA
+#define GL_TEXTURE_SWIZZLE_RGBA 0x8E46
+#endif
+
+// raylib links GLFW in but doesn't install its header, only this is needed of it
+typedef struct GLFWwindow GLFWwindow;
+void glfwSetWindowShouldClose(GLFWwindow *window, int value);
 
 #define Font XFont
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xrandr.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xdamage.h>
 #undef Font
 
 #define SCRATCH_BUFFER_IMPLEMENTATION
@@ -22,6 +50,12 @@
 
 #include "font.h"
 #include "hash.c"
+#include "convert.h"
+#include "pool.h"
+#include "png.h"
+#include "encode.h"
+#include "handoff.h"
+#include "stats.h"
 
 #define DEBUG 0
 
@@ -86,26 +120,48 @@
 #define RESIZE_RING_SEGMENTS 25
 #define RESIZE_RING_COLOR ((Color) {0, 170, 47, 255})
 
+// How long "saved" stays up once the last queued save is written
+#define SAVED_INDICATOR_NS 1500000000ull
+
 #define GLSL_VERSION 300
 
 #define XSCREENSHOTS \
-	X(screenshot); \
-	X(darker_screenshot);
+	X(screenshot);
 
 #define XTEXTURES \
-	X(screenshot_texture); \
-	X(darker_screenshot_texture);
+	X(screenshot_texture);
 
 typedef uint8_t u8;
 typedef uint32_t u32;
 typedef int32_t i32;
 typedef uint64_t u64;
+typedef int64_t i64;
 typedef u64 usize;
 
 typedef struct { u8 r, g, b; } RGB;
 
+// Native pixel layout of 24/32-bit depth X visuals, used for every
+// image kept in memory, `x` is padding with whatever the server put there
+typedef struct { u8 b, g, r, x; } BGRX;
+
+// raylib has no BGRA format, so BGRX images are declared as RGBA and
+// their textures get their channels swizzled back on the GPU
+#define SCREENSHOT_PIXEL_FORMAT PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+
 typedef struct { float w, h, x, y; } whxy_t;
 
+typedef struct { u32 w, h; i32 x, y; } region_t;
+
+// RGBA canvas pixels read back from the GPU, covering `rect` of the
+// canvas, with rows bottom-up like GL has them. Only the pixels of tiles
+// set in `tiles`, `tiles_x` to a row, are read back, the rest is garbage.
+typedef struct {
+	Color *pixels;
+	region_t rect;
+	u64 *tiles;
+	u32 tiles_x;
+} CanvasPixels;
+
 enum {
 	SELECTION_POISONED = 0,
 	SELECTION_INSIDE,
@@ -121,8 +177,10 @@ enum {
 	PASSED_WITHOUT_VALUE_UNEXPECTEDLY,
 };
 
-// Stolen from: <https://github.com/NSinecode/Raylib-Drawing-texture-in-circle/blob/master/CircleTexture.frag>
-const char* CIRCLE_SHADER =
+// Dims the whole texture by `dimFactor`, except for a bright circle
+// of `radius` around `center` with a `smoothness` wide fade at its edge.
+// Based on: <https://github.com/NSinecode/Raylib-Drawing-texture-in-circle/blob/master/CircleTexture.frag>
+const char* DIM_SHADER =
 "#version 330\n"
 "in vec2 fragTexCoord;\n"
 "in vec4 fragColor;\n"
@@ -131,26 +189,45 @@ const char* CIRCLE_SHADER =
 "uniform vec2 center;\n"
 "uniform float radius;\n"
 "uniform float smoothness;\n"
+"uniform float dimFactor;\n"
 "uniform vec2 renderSize;\n"
 "out vec4 finalColor;\n"
 "void main()\n"
 "{\n"
 "    vec2 NNfragTexCoord = fragTexCoord * renderSize;\n"
 "    float L = length(center - NNfragTexCoord);\n"
-"    float edgeThreshold = radius; \n"
-"    float alpha = smoothstep(edgeThreshold - smoothness, edgeThreshold, L);\n"
-"    if (L <= radius) {\n"
-"        finalColor = texture(texture0, fragTexCoord) * fragColor;\n"
-"        finalColor.a *= (1.0 - alpha);\n"
-"    } else {\n"
-"        finalColor = vec4(0.0);\n"
-"    }\n"
+"    float alpha = smoothstep(radius - smoothness, radius, L);\n"
+"    vec4 texel = texture(texture0, fragTexCoord) * fragColor;\n"
+"    finalColor = vec4(texel.rgb * mix(1.0, dimFactor, alpha), texel.a);\n"
 "}";
 
 #define OUTPUT_FILE_NAME "screenshot"
-#define OUTPUT_FILE_EXTENSION ".png"
 
-static size_t output_file_name_len = 0;
+// Marks where the index goes in the `name` template
+#define OUTPUT_NAME_INDEX "%n"
+#define OUTPUT_NAME_CAP 512
+
+// NULL means the working directory
+static const char *output_dir = NULL;
+static const char *output_name = OUTPUT_FILE_NAME;
+
+// Index of the next name to try, -1 until the output directory is scanned
+static i64 next_output_index = -1;
+
+// Set by the `output` and `output_fd` flags, every save is then written
+// to it instead of a file of its own, one after another
+static int output_fd = -1;
+
+// Set by the `handoff` flag, every save is then passed to the socket
+// there as raw pixels in a sealed memfd, see handoff.h
+static char handoff_path[sizeof(((struct sockaddr_un *) 0)->sun_path)] = {0};
+
+// Set by the `clipboard` flag, saves are then kept in memory and served
+// as the CLIPBOARD selection once the overlay closes, see `serve_clipboard`
+static bool clipboard_mode = false;
+
+// What saves go to when it's not a file, for messages
+static char output_target_name[sizeof(handoff_path) + 16] = {0};
 
 #define BRUSH_COLOR RED
 #define BRUSH_RADIUS 3.0f
@@ -185,16 +262,128 @@ static Vector2 cur_pos, image_pos, dmouse_pos = {0};
 static Display *xdisplay = NULL;
 static XWindowAttributes gwa = {0};
 
-static Image screenshot, darker_screenshot = {0};
-static Texture2D screenshot_texture, darker_screenshot_texture = {0};
+enum {
+	SHM_AUTO,
+	SHM_ON,
+	SHM_OFF
+};
+
+static u8 shm_mode = SHM_AUTO;
+
+// 0 means one thread per online CPU
+static u32 threads_count = 0;
+static ThreadPool pool = {0};
+static bool pool_initialized = false;
+
+// The PNG encoder has workers of its own, so that it never queues behind
+// captures on the pool above. 0 means one per online CPU as well.
+static u32 png_threads_count = 0;
+static int png_level = PNG_DEFAULT_LEVEL;
+
+// Shared-memory segment reused by every `XShmGetImage` capture on
+// `display`, `ximage` is NULL until the first successful attach.
+typedef struct {
+	Display *display;
+	XShmSegmentInfo info;
+	XImage *ximage;
+} ShmCapture;
+
+static ShmCapture shm = {0};
+static bool shm_attach_failed = false;
+
+#define MAX_CRTCS 16
+
+static region_t crtcs[MAX_CRTCS] = {0};
+static u32 crtcs_count = 0;
+
+// A connection of its own and a segment for each CRTC, so that they are
+// grabbed at the same time. Opened on the first per-CRTC capture and kept
+// until exit, like `shm`, instead of being reconnected on every trigger.
+static ShmCapture crtc_shms[MAX_CRTCS] = {0};
+
+enum {
+	MONITOR_ALL = -1,
+	MONITOR_UNDER_CURSOR = -2
+};
+
+// Index into `crtcs` of the monitor to capture, or one of the above
+static i32 monitor_idx = MONITOR_ALL;
+
+static Image screenshot = {0};
+static usize screenshot_capacity = 0;
+static Texture2D screenshot_texture = {0};
+
+static Shader dim_shader = {0};
+static int dim_shader_center_loc, dim_shader_radius_loc, dim_shader_size_loc = 0;
 
 static u8 *original_image_data = NULL;
+static usize original_image_capacity = 0;
 
 static RenderTexture2D canvas = {0};
 
+// Tiles of the canvas strokes went over since it was last cleared, a bit
+// each, row by row, and their bounding box in top-down canvas pixels,
+// with `w` 0 while it's blank. Clearing, reading back and compositing
+// skip the rest. The generation changes with every stroke and clear,
+// a readback of an older one is stale.
+#define CANVAS_TILE_SIZE 64
+
+static u64 *canvas_tiles = NULL;
+static u32 canvas_tiles_x, canvas_tiles_y, canvas_tiles_touched = 0;
+static region_t canvas_dirty = {0};
+static u32 canvas_generation = 0;
+
+// Double-buffered pixel-pack buffers, so that the canvas is read back in
+// the background when a stroke ends, and a save only maps what's already
+// copied instead of stalling on `glReadPixels`
+#define CANVAS_READBACK_BUFFERS 2
+
+typedef struct {
+	GLuint pbo[CANVAS_READBACK_BUFFERS];
+	GLsync fence[CANVAS_READBACK_BUFFERS];
+	region_t rect[CANVAS_READBACK_BUFFERS];
+	u32 generation[CANVAS_READBACK_BUFFERS];
+	bool issued[CANVAS_READBACK_BUFFERS];
+	u32 latest;
+} CanvasReadback;
+
+static CanvasReadback canvas_readback = {0};
+
 static bool immediate_screenshot_and_exit = false;
 #define IMMEDIATE_SCREENSHOT_AND_EXIT_FLAG "screenshot"
 
+// `WxH+X+Y` geometry of the area captured in `screenshot` mode,
+// the whole root window is captured when it's not provided
+static bool region_provided = false;
+static int region_mask = 0;
+static region_t region = {0};
+
+// Headless burst mode: a capture every `interval_ms` for `interval_count`
+// frames (0 means until killed), re-fetching only what XDamage reports
+static u32 interval_ms = 0;
+static u32 interval_count = 0;
+
+// Resident mode: the X connection, window, font, shader and buffers stay
+// around, captures are triggered by `trigger` clients over `socket_path`
+// or by the `hotkey` grabbed on the root window
+static bool daemon_mode = false;
+static char socket_path[sizeof(((struct sockaddr_un *) 0)->sun_path)] = {0};
+static KeySym hotkey = NoSymbol;
+
+// Command a `trigger` client sends to the daemon, NULL when not a client
+static const char *trigger_command = NULL;
+
+#define DAEMON_COMMAND_OVERLAY "overlay"
+#define DAEMON_COMMAND_SCREENSHOT "screenshot"
+#define DAEMON_COMMAND_QUIT "quit"
+#define DAEMON_COMMAND_CAP 64
+// Clients that connect and then don't say anything are dropped after this
+#define DAEMON_COMMAND_TIMEOUT_MS 1000
+
+// `stats` flag, timings and memory counters are printed to stderr at exit
+static bool stats_requested = false;
+static bool stats_json = false;
+
 static const Color colors[] = {
 	GRAY,
 	DARKGRAY,
@@ -291,914 +480,3200 @@ static const Color color_map[62] = {
 
 static bool raylib_initialized = false;
 
+INLINE static void load_dim_shader(void)
+{
+	dim_shader = LoadShaderFromMemory(0, DIM_SHADER);
+	dim_shader_center_loc = GetShaderLocation(dim_shader, "center");
+	dim_shader_radius_loc = GetShaderLocation(dim_shader, "radius");
+	dim_shader_size_loc = GetShaderLocation(dim_shader, "renderSize");
+
+	const float smoothness = 10.0f;
+	SetShaderValue(dim_shader,
+								 GetShaderLocation(dim_shader, "smoothness"),
+								 &smoothness,
+								 SHADER_UNIFORM_FLOAT);
+
+	const float dim_factor = DARKEN_FACTOR;
+	SetShaderValue(dim_shader,
+								 GetShaderLocation(dim_shader, "dimFactor"),
+								 &dim_factor,
+								 SHADER_UNIFORM_FLOAT);
+}
+
 INLINE static void init_raylib(void)
 {
 	const int m = GetCurrentMonitor();
 	SetTargetFPS(144);
 	SetTraceLogLevel(LOG_NONE);
-	if (!DEBUG) SetConfigFlags(WINDOW_FLAGS);
+	// The daemon shows its window only while an overlay is up
+	if (!DEBUG) SetConfigFlags(WINDOW_FLAGS | (daemon_mode ? FLAG_WINDOW_HIDDEN : 0));
 	InitWindow(GetMonitorWidth(m), GetMonitorHeight(m), "ss");
-	font = LoadFont_Font();
+	load_dim_shader();
 	SetExitKey(0);
 	HideCursor();
 	raylib_initialized = true;
 }
 
+INLINE static void drop_canvas_readback_fence(u32 slot)
+{
+	if (canvas_readback.fence[slot]) glDeleteSync(canvas_readback.fence[slot]);
+	canvas_readback.fence[slot] = 0;
+}
+
+static void release_canvas_readback(void)
+{
+	CanvasReadback *rb = &canvas_readback;
+	for (u32 i = 0; i < CANVAS_READBACK_BUFFERS; i++) {
+		drop_canvas_readback_fence(i);
+	}
+	if (rb->pbo[0]) glDeleteBuffers(CANVAS_READBACK_BUFFERS, rb->pbo);
+	*rb = (CanvasReadback) {0};
+}
+
 INLINE static void deinit_raylib(void)
 {
 	if (raylib_initialized) {
-		UnloadTexture(font.texture);
+		if (font.texture.id) UnloadTexture(font.texture);
+		UnloadShader(dim_shader);
+		release_canvas_readback();
+		free(canvas_tiles);
 		UnloadRenderTexture(canvas);
 		CloseWindow();
 	}
 }
 
-INLINE static void clear_canvas(void)
+// Makes a BGRX texture uploaded as RGBA sample as RGB, with opaque alpha
+INLINE static void swizzle_bgrx_texture(Texture2D texture)
 {
-	BeginTextureMode(canvas);
-	ClearBackground(BLANK);
-	EndTextureMode();
+	const GLint swizzle[4] = {GL_BLUE, GL_GREEN, GL_RED, GL_ONE};
+	rlEnableTexture(texture.id);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	rlDisableTexture();
 }
 
-INLINE static void fill_image(Image *image,
-											 int w, int h,
-											 int fmt,
-											 void *data)
+INLINE static bool canvas_tile_touched(const u64 *tiles, u32 idx)
 {
-	image->width = (i32) w;
-	image->height = (i32) h;
-	image->mipmaps = 1;
-	image->format = fmt;
-	image->data = data;
+	return tiles[idx / 64] >> (idx % 64) & 1;
 }
 
-INLINE static u8 darken_channel(u8 c)
+INLINE static usize canvas_tiles_size(void)
 {
-	return MIN(0xFF, MAX(0, c*DARKEN_FACTOR));
+	return ((usize) canvas_tiles_x*canvas_tiles_y + 63) / 64*sizeof(u64);
 }
 
-static void capture_screen(Window root, XWindowAttributes gwa)
+// Finds the next run of touched tiles in tile row `ty`, starting from
+// `*tx`, as a rect of top-down canvas pixels, and moves `*tx` past it
+static bool next_canvas_tile_run(u32 ty, u32 *tx, region_t *run)
 {
-	XImage *ximage = XGetImage(xdisplay,
-														 root,
-														 0, 0,
-														 gwa.width,
-														 gwa.height,
-														 AllPlanes,
-														 ZPixmap);
-
-	if (!ximage) {
-		panic("could not capture screen using `XGetImage`\n");
-	}
-
-	const u32 w = ximage->width;
-	const u32 h = ximage->height;
-
-	u8 *data = (u8 *) malloc(w*h*sizeof(RGB));
-	u8 *darker_data = (u8 *) malloc(w*h*sizeof(RGB));
+	const u32 row = ty*canvas_tiles_x;
+	while (*tx < canvas_tiles_x && !canvas_tile_touched(canvas_tiles, row + *tx)) (*tx)++;
+	if (*tx == canvas_tiles_x) return false;
+
+	const u32 start = *tx;
+	while (*tx < canvas_tiles_x && canvas_tile_touched(canvas_tiles, row + *tx)) (*tx)++;
+
+	const i32 x = start*CANVAS_TILE_SIZE;
+	const i32 y = ty*CANVAS_TILE_SIZE;
+	*run = (region_t) {
+		.w = MIN(*tx*CANVAS_TILE_SIZE, (u32) canvas.texture.width) - x,
+		.h = MIN(y + CANVAS_TILE_SIZE, canvas.texture.height) - y,
+		.x = x,
+		.y = y
+	};
+	return true;
+}
 
-	for (usize y = 0; y < h; y++) {
-		for (usize x = 0; x < w; x++) {
-			const u32 p = XGetPixel(ximage, x, y);
-			const usize idx = (y*w + x)*sizeof(RGB);
+// Tile rows that have any touched tiles
+#define CANVAS_DIRTY_TILE_ROWS(ty) \
+	for (u32 ty = canvas_dirty.y / CANVAS_TILE_SIZE; \
+			 ty < (canvas_dirty.y + canvas_dirty.h + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE; \
+			 ty++)
 
-			const u8 r = (p & ximage->red_mask)   >> 16;
-			const u8 g = (p & ximage->green_mask) >> 8;
-			const u8 b = (p & ximage->blue_mask)  >> 0;
+INLINE static void forget_canvas_tiles(void)
+{
+	memset(canvas_tiles, 0, canvas_tiles_size());
+	canvas_tiles_touched = 0;
+	canvas_dirty = (region_t) {0};
+	canvas_generation++;
+}
 
-			data[idx]     = r;
-			data[idx + 1] = g;
-			data[idx + 2] = b;
+// Clears the touched tiles only, a row of them at a time
+INLINE static void clear_canvas(void)
+{
+	if (!canvas_dirty.w) return;
 
-			darker_data[idx]     = darken_channel(r);
-			darker_data[idx + 1] = darken_channel(g);
-			darker_data[idx + 2] = darken_channel(b);
+	BeginTextureMode(canvas);
+	CANVAS_DIRTY_TILE_ROWS(ty) {
+		region_t run;
+		for (u32 tx = 0; next_canvas_tile_run(ty, &tx, &run);) {
+			BeginScissorMode(run.x, run.y, run.w, run.h);
+			ClearBackground(BLANK);
+			EndScissorMode();
 		}
 	}
+	EndTextureMode();
 
-	XDestroyImage(ximage);
-
-	fill_image(&screenshot,
-						 w, h,
-						 PIXELFORMAT_UNCOMPRESSED_R8G8B8,
-						 data);
-
-	fill_image(&darker_screenshot,
-						 w, h,
-						 PIXELFORMAT_UNCOMPRESSED_R8G8B8,
-						 darker_data);
+	forget_canvas_tiles();
 }
 
-// Stolen from: <https://github.com/NSinecode/Raylib-Drawing-texture-in-circle/blob/master/CircleTextureDrawing.cpp>
-static void DrawCollisionTextureCircle(Texture2D texture,
-																Vector2 pos,
-																Vector2 circle_center,
-																float radius,
-																Color color)
+// Sizes the tiles for a new canvas and clears all of it
+static void reset_canvas(void)
 {
-	const Shader shader = LoadShaderFromMemory(0, CIRCLE_SHADER);
-	const int radius_loc = GetShaderLocation(shader, "radius");
-	SetShaderValue(shader, radius_loc, &radius, SHADER_UNIFORM_FLOAT);
+	canvas_tiles_x = (canvas.texture.width + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+	canvas_tiles_y = (canvas.texture.height + CANVAS_TILE_SIZE - 1) / CANVAS_TILE_SIZE;
+	free(canvas_tiles);
+	canvas_tiles = (u64 *) malloc(canvas_tiles_size());
+	STATS_ALLOC(canvas_tiles_size());
 
-	const float ci_ce[2] = {circle_center.x, circle_center.y};
-	const int center_loc = GetShaderLocation(shader, "center");
-	SetShaderValue(shader, center_loc, &ci_ce, SHADER_UNIFORM_VEC2);
+	BeginTextureMode(canvas);
+	ClearBackground(BLANK);
+	EndTextureMode();
 
-	const float resolution[2] = {texture.width, texture.height};
-	const int resol_loc = GetShaderLocation(shader, "renderSize");
-	SetShaderValue(shader, resol_loc, &resolution, SHADER_UNIFORM_VEC2);
+	forget_canvas_tiles();
+}
 
-	const float smoothness = 10.0f;
-	const int smoothnessLoc = GetShaderLocation(shader, "smoothness");
-	SetShaderValue(shader, smoothnessLoc, &smoothness, SHADER_UNIFORM_FLOAT);
+// Marks the tiles under a brush stamp of `radius` at `center`
+static void mark_canvas_tiles(Vector2 center, float radius)
+{
+	// One more pixel for the antialiased edge
+	const float r = radius + 1.0f;
+	const i32 x0 = MAX((i32) floorf(center.x - r), 0);
+	const i32 y0 = MAX((i32) floorf(center.y - r), 0);
+	const i32 x1 = MIN((i32) ceilf(center.x + r), canvas.texture.width);
+	const i32 y1 = MIN((i32) ceilf(center.y + r), canvas.texture.height);
+
+	canvas_generation++;
+	if (x1 <= x0 || y1 <= y0) return;
+
+	const u32 tx0 = x0 / CANVAS_TILE_SIZE, tx1 = (x1 - 1) / CANVAS_TILE_SIZE;
+	const u32 ty0 = y0 / CANVAS_TILE_SIZE, ty1 = (y1 - 1) / CANVAS_TILE_SIZE;
+
+	for (u32 ty = ty0; ty <= ty1; ty++) {
+		for (u32 tx = tx0; tx <= tx1; tx++) {
+			const u32 idx = ty*canvas_tiles_x + tx;
+			if (canvas_tile_touched(canvas_tiles, idx)) continue;
+			canvas_tiles[idx / 64] |= 1ull << (idx % 64);
+			canvas_tiles_touched++;
+		}
+	}
 
-	BeginShaderMode(shader);
+	// The box is kept on tile edges, readbacks are laid out by it
+	i32 bx0 = tx0*CANVAS_TILE_SIZE, by0 = ty0*CANVAS_TILE_SIZE;
+	i32 bx1 = MIN((tx1 + 1)*CANVAS_TILE_SIZE, (u32) canvas.texture.width);
+	i32 by1 = MIN((ty1 + 1)*CANVAS_TILE_SIZE, (u32) canvas.texture.height);
 
-	DrawTextureEx(texture, pos, 0, zoom, color);
+	if (canvas_dirty.w) {
+		bx0 = MIN(bx0, canvas_dirty.x);
+		by0 = MIN(by0, canvas_dirty.y);
+		bx1 = MAX(bx1, canvas_dirty.x + (i32) canvas_dirty.w);
+		by1 = MAX(by1, canvas_dirty.y + (i32) canvas_dirty.h);
+	}
 
-	EndShaderMode();
-	UnloadShader(shader);
+	canvas_dirty = (region_t) {.w = bx1 - bx0, .h = by1 - by0, .x = bx0, .y = by0};
 }
 
-INLINE static void stop_selection_mode(void)
+// Row of the bottom-up readback of `rect` that holds the bottom row of `run`
+INLINE static usize canvas_readback_row(region_t rect, region_t run)
 {
-	memset(&selection_start,
-				 DOUBLE_UNINITIALIZED,
-				 sizeof(selection_start));
-
-	memset(&selection_end,
-				 DOUBLE_UNINITIALIZED,
-				 sizeof(selection_end));
-
-	selection_mode = false;
-	resize_mode = false;
+	return (usize) (rect.y + (i32) rect.h - (run.y + (i32) run.h));
 }
 
-INLINE static void stop_color_selector_mode(void)
+// Queues a copy of the dirty part of the canvas into the next pixel-pack
+// buffer, the GPU does it while the overlay goes on drawing frames
+static void start_canvas_readback(void)
 {
-	memset(&color_selector_entered_position,
-				 DOUBLE_UNINITIALIZED,
-				 sizeof(color_selector_entered_position));
+	CanvasReadback *rb = &canvas_readback;
+	if (!canvas_dirty.w) return;
+
+	if (!rb->pbo[0]) glGenBuffers(CANVAS_READBACK_BUFFERS, rb->pbo);
+
+	const u32 slot = (rb->latest + 1) % CANVAS_READBACK_BUFFERS;
+	const region_t rect = canvas_dirty;
+	drop_canvas_readback_fence(slot);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo[slot]);
+	glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) rect.w*rect.h*sizeof(Color), NULL, GL_STREAM_READ);
+
+	// Every run of touched tiles lands where it is in the rect, GL rows
+	// go bottom-up, so the rect is flipped into them
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, canvas.id);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glPixelStorei(GL_PACK_ROW_LENGTH, rect.w);
+	CANVAS_DIRTY_TILE_ROWS(ty) {
+		region_t run;
+		for (u32 tx = 0; next_canvas_tile_run(ty, &tx, &run);) {
+			const usize offset = canvas_readback_row(rect, run)*rect.w + (run.x - rect.x);
+			glReadPixels(run.x, canvas.texture.height - run.y - (i32) run.h, run.w, run.h,
+									 GL_RGBA, GL_UNSIGNED_BYTE, (void *) (offset*sizeof(Color)));
+		}
+	}
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-	color_selector_mode = false;
+	rb->fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	rb->rect[slot] = rect;
+	rb->generation[slot] = canvas_generation;
+	rb->issued[slot] = true;
+	rb->latest = slot;
 }
 
-INLINE static void stop_resizing(void)
+INLINE static void fill_image(Image *image,
+											 int w, int h,
+											 int fmt,
+											 void *data)
 {
-	resizing_now = false;
-	resizing_what = SELECTION_POISONED;
+	image->width = (i32) w;
+	image->height = (i32) h;
+	image->mipmaps = 1;
+	image->format = fmt;
+	image->data = data;
 }
 
-INLINE static void stop_timer_mode(void)
+INLINE static u64 monotonic_ns(void)
 {
-	timer_mode = false;
-	timer_start = -1;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64) ts.tv_sec*1000000000ull + ts.tv_nsec;
 }
 
-INLINE static whxy_t get_selection_data(void)
+INLINE static void sleep_until_ns(u64 deadline)
 {
-	return (whxy_t) {
-		.w = fabsf(selection_end.x - selection_start.x),
-		.h = fabsf(selection_end.y - selection_start.y),
-		.x = fminf(selection_start.x, selection_end.x),
-		.y = fminf(selection_start.y, selection_end.y)
+	const struct timespec ts = {
+		.tv_sec = deadline / 1000000000ull,
+		.tv_nsec = deadline % 1000000000ull
 	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
 }
 
-#define get_file_path(...) get_file_path_(__VA_ARGS__, 0)
+static int shm_error_handler(Display *display UNUSED, XErrorEvent *event UNUSED)
+{
+	shm_attach_failed = true;
+	return 0;
+}
 
-// add _<number> at the end if needed to prevent overwriting
-char *get_file_path_(char *file_path, u64 rec_count)
+static void shm_release(ShmCapture *shm)
 {
-	if (access(file_path, F_OK) == 0) {
-		scratch_buffer_clear();
-		char *number_start = file_path + output_file_name_len;
-		if (*number_start == '\0') {
-			scratch_buffer_printf("%s_%zu.png", OUTPUT_FILE_NAME, 0);
-		} else {
-			//										skip `_`
-			u64 number = strtoull(number_start + 1, NULL, 10);
-			scratch_buffer_printf("%s_%zu.png", OUTPUT_FILE_NAME, number + 1);
-		}
+	if (!shm->ximage) return;
 
-		return get_file_path_(scratch_buffer_to_string(), rec_count++);
-	}
+	XShmDetach(shm->display, &shm->info);
+	XDestroyImage(shm->ximage);
+	shmdt(shm->info.shmaddr);
 
-	return file_path;
+	shm->ximage = NULL;
+	memset(&shm->info, 0, sizeof(shm->info));
 }
 
-INLINE static u8 *draw_canvas_into_image(u8 *data, int w, int h)
+// (Re)creates the shared segment if it can't hold a `w`x`h` image,
+// returns false when the server refuses to attach it, e.g. remote displays.
+// Swaps the process-wide X error handler, so don't call it from worker threads.
+static bool shm_ensure(ShmCapture *shm, XWindowAttributes gwa, u32 w, u32 h)
 {
-	Image image = (Image) {
-		.data = data,
-		.width = w,
-		.height = h,
-		.mipmaps = screenshot.mipmaps,
-		.format = screenshot.format
-	};
+	if (shm->ximage && (u32) shm->ximage->width == w && (u32) shm->ximage->height == h) {
+		return true;
+	}
 
-	Image canvas_image = LoadImageFromTexture(canvas.texture);
+	shm_release(shm);
+
+	XImage *ximage = XShmCreateImage(shm->display,
+																	 gwa.visual,
+																	 gwa.depth,
+																	 ZPixmap,
+																	 NULL,
+																	 &shm->info,
+																	 w, h);
+	if (!ximage) return false;
+
+	shm->info.shmid = shmget(IPC_PRIVATE,
+													 ximage->bytes_per_line*ximage->height,
+													 IPC_CREAT | 0600);
+	if (shm->info.shmid < 0) {
+		XDestroyImage(ximage);
+		return false;
+	}
+
+	shm->info.shmaddr = ximage->data = shmat(shm->info.shmid, NULL, 0);
+	shm->info.readOnly = False;
 
-	Rectangle src_rec = {0, 0, canvas_image.width, canvas_image.height};
-	Rectangle dst_rec = {0, 0, image.width, image.height};
+	if (shm->info.shmaddr == (char *) -1) {
+		shmctl(shm->info.shmid, IPC_RMID, NULL);
+		ximage->data = NULL;
+		XDestroyImage(ximage);
+		return false;
+	}
 
-	ImageDraw(&image, canvas_image, src_rec, dst_rec, WHITE);
+	// `XShmAttach` reports failure asynchronously, so catch it with a sync
+	shm_attach_failed = false;
+	XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+	XShmAttach(shm->display, &shm->info);
+	XSync(shm->display, False);
+	XSetErrorHandler(old_handler);
+
+	// Mark the segment for removal right away, so it doesn't outlive us
+	shmctl(shm->info.shmid, IPC_RMID, NULL);
+
+	if (shm_attach_failed) {
+		XDestroyImage(ximage);
+		shmdt(shm->info.shmaddr);
+		memset(&shm->info, 0, sizeof(shm->info));
+		return false;
+	}
 
-	return image.data;
+	shm->ximage = ximage;
+	return true;
 }
 
-INLINE static void save_fullscreen(void)
+INLINE static bool shm_available(Display *display)
 {
-	const char *file_path = get_file_path(OUTPUT_FILE_NAME
-																				OUTPUT_FILE_EXTENSION);
-	Image image = (Image) {
-		.data = original_image_data,
-		.width = screenshot.width,
-		.height = screenshot.height,
-		.mipmaps = screenshot.mipmaps,
-		.format = screenshot.format
-	};
-
-	image.data = draw_canvas_into_image(image.data, image.width, image.height);
-
-	ExportImage(image, file_path);
+	return shm_mode != SHM_OFF && XShmQueryExtension(display);
 }
 
-INLINE static void save_image_data(u8 *data, int w, int h)
+// Grabs through the segment if `shm_ensure` managed to attach one,
+// touches nothing process-wide, so it can run on worker threads.
+// Returns NULL on failure for the caller to panic on the main thread.
+static XImage *grab_ximage_prepared(ShmCapture *shm, Window root, region_t area)
 {
-	const char *file_path = get_file_path(OUTPUT_FILE_NAME
-																				OUTPUT_FILE_EXTENSION);
+	if (shm->ximage) {
+		if (XShmGetImage(shm->display, root, shm->ximage, area.x, area.y, AllPlanes)) {
+			return shm->ximage;
+		}
+	}
 
-	Image image = (Image) {
-		.data = data,
-		.width = w,
-		.height = h,
-		.mipmaps = screenshot.mipmaps,
-		.format = screenshot.format
-	};
+	if (shm_mode == SHM_ON) return NULL;
 
-	ExportImage(image, file_path);
+	return XGetImage(shm->display,
+									 root,
+									 area.x, area.y,
+									 area.w, area.h,
+									 AllPlanes,
+									 ZPixmap);
 }
 
-INLINE static i32 wrap(i32 x, i32 max)
+static XImage *grab_ximage(ShmCapture *shm,
+													 Window root, XWindowAttributes gwa,
+													 region_t area)
 {
-	x %= max;
-	if (x < 0) x += max;
-	return x;
+	STATS_BEGIN(capture);
+
+	if (shm_available(shm->display)) {
+		shm_ensure(shm, gwa, area.w, area.h);
+	}
+
+	XImage *ximage = grab_ximage_prepared(shm, root, area);
+
+	STATS_END(capture);
+	if (ximage && ximage != shm->ximage) {
+		STATS_ALLOC((usize) ximage->bytes_per_line*ximage->height);
+	}
+
+	return ximage;
 }
 
-INLINE static u8 *crop_image(const u8 *img_data,
-														 i32 img_w, i32 img_h,
-														 i32 w, i32 h,
-														 i32 x, i32 y)
+// Grabs `rect` through the attached segment when it fits, using a throwaway
+// image header of `rect`'s size over the same shared memory
+static XImage *grab_ximage_rect(ShmCapture *shm,
+																Window root, XWindowAttributes gwa,
+																region_t rect)
 {
-	u8 *data = (u8 *) malloc(w*h*sizeof(RGB));
-	for (i32 row = 0; row < h; row++) {
-		i32 wy = wrap(y + row, img_h);
-		for (i32 col = 0; col < w; col++) {
-			i32 wx = wrap(x + col, img_w);
-			i32 src_offset = (wy*img_w + wx)*sizeof(RGB);
-			i32 dst_offset = (row*w + col)*sizeof(RGB);
-			memcpy(data + dst_offset, img_data + src_offset, sizeof(RGB));
+	if (shm->ximage) {
+		XImage *sub = XShmCreateImage(shm->display,
+																	gwa.visual,
+																	gwa.depth,
+																	ZPixmap,
+																	shm->info.shmaddr,
+																	&shm->info,
+																	rect.w, rect.h);
+		if (sub) {
+			const usize size = (usize) sub->bytes_per_line*sub->height;
+			const usize capacity = (usize) shm->ximage->bytes_per_line*shm->ximage->height;
+			if (size <= capacity && XShmGetImage(shm->display, root, sub, rect.x, rect.y, AllPlanes)) {
+				return sub;
+			}
+
+			// Destroying a shared image only frees its header
+			XDestroyImage(sub);
 		}
 	}
 
-	return data;
+	return XGetImage(shm->display,
+									 root,
+									 rect.x, rect.y,
+									 rect.w, rect.h,
+									 AllPlanes,
+									 ZPixmap);
 }
 
-INLINE static void get_selection_corners(whxy_t whxy,
-																				 Vector2 *upper_left,
-																				 Vector2 *upper_right,
-																				 Vector2 *bottom_left,
-																				 Vector2 *bottom_right)
+INLINE static void release_ximage(const ShmCapture *shm, XImage *ximage)
 {
-	WHXY_UNPACK
-
-	upper_left->x = x;
-	upper_left->y = y;
+	// The shared image is kept around to be reused by the next capture
+	if (ximage != shm->ximage) {
+		XDestroyImage(ximage);
+	}
+}
 
-	upper_right->x = x + w;
-	upper_right->y = y;
+// Active CRTCs clipped to the root window, empty if XRandR isn't there
+static void query_crtcs(Window root, XWindowAttributes gwa)
+{
+	// The daemon asks again on every trigger, the layout may have changed since
+	crtcs_count = 0;
+
+	int event_base, error_base;
+	if (!XRRQueryExtension(xdisplay, &event_base, &error_base)) return;
+
+	XRRScreenResources *res = XRRGetScreenResourcesCurrent(xdisplay, root);
+	if (!res) return;
+
+	for (int i = 0; i < res->ncrtc && crtcs_count < MAX_CRTCS; i++) {
+		XRRCrtcInfo *info = XRRGetCrtcInfo(xdisplay, res, res->crtcs[i]);
+		if (!info) continue;
+
+		const i32 x0 = MAX(0, info->x);
+		const i32 y0 = MAX(0, info->y);
+		const i32 x1 = MIN(gwa.width,  info->x + (i32) info->width);
+		const i32 y1 = MIN(gwa.height, info->y + (i32) info->height);
+
+		if (info->mode != None && x1 > x0 && y1 > y0) {
+			crtcs[crtcs_count++] = (region_t) {
+				.w = x1 - x0,
+				.h = y1 - y0,
+				.x = x0,
+				.y = y0
+			};
+		}
 
-	bottom_left->x = x;
-	bottom_left->y = y + h;
+		XRRFreeCrtcInfo(info);
+	}
 
-	bottom_right->x = x + w;
-	bottom_right->y = y + h;
+	XRRFreeScreenResources(res);
 }
 
-static bool selection_check_collisions(Vector2 mouse_pos)
+static i32 crtc_under_cursor(Window root)
 {
-	const whxy_t whxy = get_selection_data();
-	WHXY_UNPACK
+	Window root_ret, child_ret;
+	int x, y, win_x, win_y;
+	unsigned mask;
+	if (!XQueryPointer(xdisplay, root, &root_ret, &child_ret, &x, &y, &win_x, &win_y, &mask)) {
+		return -1;
+	}
 
-	const Rectangle rec = (Rectangle) {
-		.width = w,
-		.height = h,
-		.x = x,
-		.y = y,
-	};
+	for (u32 i = 0; i < crtcs_count; i++) {
+		const region_t c = crtcs[i];
+		if (x >= c.x && x < c.x + (i32) c.w && y >= c.y && y < c.y + (i32) c.h) {
+			return (i32) i;
+		}
+	}
 
-	return CheckCollisionPointRec(mouse_pos, rec);
+	return -1;
 }
 
-static u8 selection_check_corner_collisions(Vector2 mouse_pos)
+// The area `capture_screen` should grab according to the `monitor` flag
+static region_t monitor_area(Window root, XWindowAttributes gwa)
 {
-	Vector2 up_l, up_r, bot_l, bot_r = {0};
-	get_selection_corners(get_selection_data(),
-												&up_l, &up_r,
-												&bot_l, &bot_r);
+	const region_t whole = {.w = gwa.width, .h = gwa.height};
+	if (monitor_idx == MONITOR_ALL) return whole;
 
-	if (CheckCollisionPointCircle(mouse_pos, up_l, RESIZE_RING_RADIUS)) {
-		return SELECTION_UPPER_LEFT;
+	if (crtcs_count == 0) {
+		panic("could not query monitors using XRandR\n");
 	}
 
-	if (CheckCollisionPointCircle(mouse_pos, up_r, RESIZE_RING_RADIUS)) {
-		return SELECTION_UPPER_RIGHT;
-	}
+	const i32 idx = monitor_idx == MONITOR_UNDER_CURSOR
+		? crtc_under_cursor(root)
+		: monitor_idx;
 
-	if (CheckCollisionPointCircle(mouse_pos, bot_l, RESIZE_RING_RADIUS)) {
-		return SELECTION_BOTTOM_LEFT;
+	if (idx < 0 || (u32) idx >= crtcs_count) {
+		if (monitor_idx == MONITOR_UNDER_CURSOR) return whole;
+		panic("monitor %d doesn't exist, there are %u active monitors\n", idx, crtcs_count);
 	}
 
-	if (CheckCollisionPointCircle(mouse_pos, bot_r, RESIZE_RING_RADIUS)) {
-		return SELECTION_BOTTOM_RIGHT;
+	return crtcs[idx];
+}
+
+// Makes sure the specialized kernel picked for this visual agrees with
+// the generic mask-driven one on the whole captured image
+static void check_convert_kernel(ConvertKernel kernel,
+																 const PixelLayout *layout,
+																 const XImage *ximage,
+																 const u8 *data,
+																 usize data_stride)
+{
+	const u32 w = ximage->width;
+	const u32 h = ximage->height;
+	const usize row_size = w*sizeof(BGRX);
+
+	u8 *expected = (u8 *) malloc(h*row_size);
+	convert_rows(convert_kernel_generic,
+							 layout,
+							 (const u8 *) ximage->data,
+							 ximage->bytes_per_line,
+							 expected, row_size,
+							 w, 0, h);
+
+	eprintf("using `%s` to convert %d bpp image\n", kernel.name, ximage->bits_per_pixel);
+	for (u32 y = 0; y < h; y++) {
+		const BGRX *expected_row = (const BGRX *) (expected + y*row_size);
+		const BGRX *row = (const BGRX *) (data + y*data_stride);
+		for (u32 x = 0; x < w; x++) {
+			// The padding byte is only copied by some kernels
+			if (memcmp(&expected_row[x], &row[x], 3) != 0) {
+				panic("`%s` disagrees with `%s`\n", kernel.name, convert_kernel_generic.name);
+			}
+		}
 	}
 
-	return SELECTION_POISONED;
+	free(expected);
 }
 
-INLINE static Vector2 Vector2Value(float value)
+#define CONVERT_MIN_BAND_ROWS 32
+
+typedef struct {
+	const XImage *ximage;
+	const PixelLayout *layout;
+	ConvertKernel kernel;
+	u8 *data;
+	usize data_stride;
+	u32 w, h, band_rows;
+} ConvertJob;
+
+// Converts one band of rows, bands never overlap
+// so the result doesn't depend on the number of threads
+static void convert_band(void *ctx, u32 band)
 {
-	return (Vector2) {value, value};
+	const ConvertJob *job = (const ConvertJob *) ctx;
+	const XImage *ximage = job->ximage;
+
+	const u32 y0 = band*job->band_rows;
+	const u32 y1 = MIN(job->h, y0 + job->band_rows);
+
+	convert_rows(job->kernel,
+							 job->layout,
+							 (const u8 *) ximage->data,
+							 ximage->bytes_per_line,
+							 job->data, job->data_stride,
+							 job->w, y0, y1);
 }
 
-INLINE static Vector2 Vector2DivideValue(Vector2 v, float div)
+INLINE static void ensure_pool(void)
 {
-	return (Vector2) { v.x / div, v.y / div };
+	if (!pool_initialized) {
+		pool_init(&pool, threads_count ? threads_count : pool_default_threads_count());
+		pool_initialized = true;
+	}
 }
 
-static void take_screenshot(void)
+INLINE static u32 png_threads(void)
 {
-	if (selection_mode) {
-		const whxy_t whxy = get_selection_data();
+	return png_threads_count ? png_threads_count : pool_default_threads_count();
+}
 
-		WHXY_UNPACK_I32
+static u8 *encode_png(const u8 *data, usize stride, u32 w, u32 h, usize *size)
+{
+	return png_encode(data, stride, w, h, png_level, png_threads(), size);
+}
 
-		x = fabsf(x - image_pos.x) / zoom;
-		y = fabsf(y - image_pos.y) / zoom;
-		w /= zoom;
-		h /= zoom;
+static bool write_png(const u8 *data, usize stride, u32 w, u32 h,
+											encode_write_fn write, void *write_ctx)
+{
+	return png_write(data, stride, w, h, png_level, png_threads(), write, write_ctx);
+}
 
-		u8 *drawn_data = (u8 *) malloc(screenshot.width*screenshot.height*sizeof(RGB));
-		memcpy(drawn_data, original_image_data, screenshot.width*screenshot.height*sizeof(RGB));
+typedef u8 *(*encode_fn)(const u8 *bgrx, usize stride, u32 w, u32 h, usize *size);
+typedef bool (*stream_fn)(const u8 *bgrx, usize stride, u32 w, u32 h,
+													encode_write_fn write, void *write_ctx);
+
+// `stream` writes the file out as it's encoded, where the format allows it
+typedef struct {
+	const char *name;
+	const char *extension;
+	encode_fn encode;
+	stream_fn stream;
+} OutputFormat;
+
+// The first one is the default
+static const OutputFormat output_formats[] = {
+	{ "png", ".png", encode_png, write_png },
+	{ "qoi", ".qoi", qoi_encode, NULL },
+	{ "ppm", ".ppm", ppm_encode, ppm_write },
+	{ "bmp", ".bmp", bmp_encode, bmp_write }
+};
 
-		Image image = (Image) {
-			.data = drawn_data,
-			.width = screenshot.width,
-			.height = screenshot.height,
-			.mipmaps = screenshot.mipmaps,
-			.format = screenshot.format
-		};
+#define OUTPUT_FORMATS_COUNT (sizeof(output_formats) / sizeof(OutputFormat))
 
-		// TODO: avoid flipping the image twice, but flip canvas once
-		ImageFlipVertical(&image);
+static const OutputFormat *output_format = &output_formats[0];
 
-		image.data = draw_canvas_into_image(image.data, image.width, image.height);
+// Converts the whole `ximage` into BGRX rows of `data`, `data_stride` bytes apart
+static void convert_ximage(const XImage *ximage, u8 *data, usize data_stride)
+{
+	const u32 w = ximage->width;
+	const u32 h = ximage->height;
 
-		ImageFlipVertical(&image);
+	const PixelLayout layout = pixel_layout(ximage->bits_per_pixel,
+																					ximage->byte_order == MSBFirst,
+																					ximage->red_mask,
+																					ximage->green_mask,
+																					ximage->blue_mask);
+
+	if (!pixel_layout_supported(&layout)) {
+		panic("unsupported visual: %d bits per pixel, masks %06lx/%06lx/%06lx\n",
+					ximage->bits_per_pixel,
+					ximage->red_mask,
+					ximage->green_mask,
+					ximage->blue_mask);
+	}
 
-		u8 *data = crop_image(image.data,
-													screenshot.width,
-													screenshot.height,
-													w, h, x, y);
+	const ConvertKernel kernel = select_convert_kernel(&layout);
 
-		stop_selection_mode();
-		save_image_data(data, w, h);
+	ConvertJob job = {
+		.ximage = ximage,
+		.layout = &layout,
+		.kernel = kernel,
+		.data = data,
+		.data_stride = data_stride,
+		.w = w,
+		.h = h
+	};
 
-		free(data);
-		free(drawn_data);
-	} else {
-		save_fullscreen();
-	}
+	ensure_pool();
 
-	clear_canvas();
-}
+	// A few bands per thread to even out the load, but not too thin ones
+	const u32 bands = (pool.workers_count + 1)*4;
+	job.band_rows = MAX(CONVERT_MIN_BAND_ROWS, (h + bands - 1) / bands);
+
+	STATS_BEGIN(convert);
+	pool_run(&pool, convert_band, &job, (h + job.band_rows - 1) / job.band_rows);
+	STATS_END(convert);
+
+	if (DEBUG) check_convert_kernel(kernel, &layout, ximage, data, data_stride);
+}
+
+typedef struct {
+	Window root;
+	region_t area;
+	ShmCapture *shm;
+	XImage *ximage;
+} CrtcGrab;
+
+static void grab_crtc(void *ctx, u32 idx)
+{
+	CrtcGrab *grab = &((CrtcGrab *) ctx)[idx];
+	grab->ximage = grab_ximage_prepared(grab->shm, grab->root, grab->area);
+}
+
+static void release_crtc_connection(ShmCapture *shm)
+{
+	if (!shm->display) return;
+
+	shm_release(shm);
+	XCloseDisplay(shm->display);
+	shm->display = NULL;
+}
+
+static void release_crtc_connections(void)
+{
+	for (u32 i = 0; i < MAX_CRTCS; i++) {
+		release_crtc_connection(&crtc_shms[i]);
+	}
+}
+
+// Grabs every CRTC on its own X connection at the same time,
+// and converts them into their places of the virtual screen.
+// The dead space between monitors is never fetched and stays black.
+static void capture_crtcs(Window root, XWindowAttributes gwa, u8 *data)
+{
+	const usize stride = gwa.width*sizeof(BGRX);
+	const char *display_name = DisplayString(xdisplay);
+
+	STATS_BEGIN(capture);
+
+	CrtcGrab grabs[MAX_CRTCS] = {0};
+	for (u32 i = 0; i < crtcs_count; i++) {
+		CrtcGrab *grab = &grabs[i];
+		grab->root = root;
+		grab->area = crtcs[i];
+		grab->shm = &crtc_shms[i];
+
+		if (!grab->shm->display) {
+			grab->shm->display = XOpenDisplay(display_name);
+			if (!grab->shm->display) {
+				panic("could not open another connection to the X display\n");
+			}
+		}
+
+		// A `Visual` only means something to the connection it came from,
+		// and the root window's is the default one of its screen
+		Display *display = grab->shm->display;
+		XWindowAttributes crtc_gwa = gwa;
+		crtc_gwa.screen = ScreenOfDisplay(display, XScreenNumberOfScreen(gwa.screen));
+		crtc_gwa.visual = DefaultVisualOfScreen(crtc_gwa.screen);
+
+		// Attach segments up front, `shm_ensure` isn't thread-safe, and it
+		// keeps the segment when the monitor kept its size since last time
+		if (shm_available(display)) {
+			shm_ensure(grab->shm, crtc_gwa, grab->area.w, grab->area.h);
+		}
+	}
+
+	// Monitors unplugged since the last capture don't need theirs anymore
+	for (u32 i = crtcs_count; i < MAX_CRTCS; i++) {
+		release_crtc_connection(&crtc_shms[i]);
+	}
+
+	ensure_pool();
+	pool_run(&pool, grab_crtc, grabs, crtcs_count);
+
+	STATS_END(capture);
+
+	for (u32 i = 0; i < crtcs_count; i++) {
+		CrtcGrab *grab = &grabs[i];
+		// Workers only report failures, exiting is left to this thread
+		if (!grab->ximage) {
+			panic("could not capture monitor %u using `%s`\n", i,
+						shm_mode == SHM_ON ? "XShmGetImage" : "XGetImage");
+		}
+
+		if (grab->ximage != grab->shm->ximage) {
+			STATS_ALLOC((usize) grab->ximage->bytes_per_line*grab->ximage->height);
+		}
+
+		u8 *dst = data + grab->area.y*stride + grab->area.x*sizeof(BGRX);
+		convert_ximage(grab->ximage, dst, stride);
+
+		release_ximage(grab->shm, grab->ximage);
+	}
+}
+
+// True when the CRTCs leave parts of the root window uncovered
+// or there is more than one of them to grab in parallel
+INLINE static bool crtcs_worth_grabbing(XWindowAttributes gwa)
+{
+	if (crtcs_count > 1) return true;
+	return crtcs_count == 1 && (crtcs[0].w != (u32) gwa.width || crtcs[0].h != (u32) gwa.height);
+}
+
+// Returns `data` if it already holds `size` bytes, or a new buffer in its place,
+// so that the daemon doesn't go through the allocator on every capture
+static u8 *reuse_buffer(u8 *data, usize *capacity, usize size)
+{
+	if (data && *capacity >= size) return data;
+
+	free(data);
+	*capacity = size;
+	STATS_ALLOC(size);
+	return (u8 *) malloc(size);
+}
+
+// Captures `area` into BGRX rows of `data`, 4 bytes per pixel and no padding
+static void capture_area(Window root, XWindowAttributes gwa, region_t area, u8 *data)
+{
+	const bool whole_screen = area.x == 0 && area.y == 0 &&
+		area.w == (u32) gwa.width && area.h == (u32) gwa.height;
+
+	const usize stride = area.w*sizeof(BGRX);
+
+	if (whole_screen && crtcs_worth_grabbing(gwa)) {
+		memset(data, 0, area.h*stride);
+		capture_crtcs(root, gwa, data);
+	} else {
+		XImage *ximage = grab_ximage(&shm, root, gwa, area);
+
+		if (!ximage) {
+			panic("could not capture screen using `%s`\n",
+						shm_mode == SHM_ON ? "XShmGetImage" : "XGetImage");
+		}
+
+		convert_ximage(ximage, data, stride);
+		release_ximage(&shm, ximage);
+	}
+}
+
+// Overwrites `screenshot`, reusing its pixels buffer when it's big enough
+static void capture_screen(Window root, XWindowAttributes gwa, region_t area)
+{
+	u8 *data = reuse_buffer((u8 *) screenshot.data,
+													&screenshot_capacity,
+													(usize) area.h*area.w*sizeof(BGRX));
+
+	capture_area(root, gwa, area, data);
+
+	fill_image(&screenshot,
+						 area.w, area.h,
+						 SCREENSHOT_PIXEL_FORMAT,
+						 data);
+}
+
+// Draws the screenshot at `image_pos`, dimmed by `DARKEN_FACTOR` everywhere
+// except for a circle of `radius` around `circle_center`, pass 0 to dim it all.
+// Based on: <https://github.com/NSinecode/Raylib-Drawing-texture-in-circle/blob/master/CircleTextureDrawing.cpp>
+static void draw_dimmed_screenshot(Vector2 circle_center, float radius)
+{
+	SetShaderValue(dim_shader, dim_shader_radius_loc, &radius, SHADER_UNIFORM_FLOAT);
+
+	const float ci_ce[2] = {circle_center.x, circle_center.y};
+	SetShaderValue(dim_shader, dim_shader_center_loc, &ci_ce, SHADER_UNIFORM_VEC2);
+
+	const float resolution[2] = {screenshot_texture.width, screenshot_texture.height};
+	SetShaderValue(dim_shader, dim_shader_size_loc, &resolution, SHADER_UNIFORM_VEC2);
+
+	BeginShaderMode(dim_shader);
+
+	DrawTextureEx(screenshot_texture, image_pos, 0, zoom, WHITE);
+
+	EndShaderMode();
+}
+
+INLINE static void stop_selection_mode(void)
+{
+	memset(&selection_start,
+				 DOUBLE_UNINITIALIZED,
+				 sizeof(selection_start));
+
+	memset(&selection_end,
+				 DOUBLE_UNINITIALIZED,
+				 sizeof(selection_end));
+
+	selection_mode = false;
+	resize_mode = false;
+}
+
+INLINE static void stop_color_selector_mode(void)
+{
+	memset(&color_selector_entered_position,
+				 DOUBLE_UNINITIALIZED,
+				 sizeof(color_selector_entered_position));
+
+	color_selector_mode = false;
+}
+
+INLINE static void stop_resizing(void)
+{
+	resizing_now = false;
+	resizing_what = SELECTION_POISONED;
+}
+
+INLINE static void stop_timer_mode(void)
+{
+	timer_mode = false;
+	timer_start = -1;
+}
+
+INLINE static whxy_t get_selection_data(void)
+{
+	return (whxy_t) {
+		.w = fabsf(selection_end.x - selection_start.x),
+		.h = fabsf(selection_end.y - selection_start.y),
+		.x = fminf(selection_start.x, selection_end.x),
+		.y = fminf(selection_start.y, selection_end.y)
+	};
+}
+
+// Splits the `name` template around the index into `prefix` and `suffix`,
+// the extension included. A template without the index gets it as `_<index>`
+// at the end, and leaves it out altogether for index 0, which keeps the
+// sequence ss always had: `screenshot.png`, `screenshot_1.png` and so on.
+static void output_name_parts(char *prefix, char *suffix, usize cap)
+{
+	const char *marker = strstr(output_name, OUTPUT_NAME_INDEX);
+	if (marker) {
+		snprintf(prefix, cap, "%.*s", (int) (marker - output_name), output_name);
+		snprintf(suffix, cap, "%s%s", marker + strlen(OUTPUT_NAME_INDEX), output_format->extension);
+	} else {
+		snprintf(prefix, cap, "%s_", output_name);
+		snprintf(suffix, cap, "%s", output_format->extension);
+	}
+}
+
+// Highest index taken by the names already in the output directory, -1 if none is
+static i64 scan_output_dir(void)
+{
+	char prefix[OUTPUT_NAME_CAP], suffix[OUTPUT_NAME_CAP], bare[OUTPUT_NAME_CAP];
+	output_name_parts(prefix, suffix, sizeof(prefix));
+	snprintf(bare, sizeof(bare), "%s%s", output_name, output_format->extension);
+
+	const bool indexed = strstr(output_name, OUTPUT_NAME_INDEX) != NULL;
+	const usize prefix_len = strlen(prefix);
+
+	DIR *dir = opendir(output_dir ? output_dir : ".");
+	if (!dir) return -1;
+
+	i64 max = -1;
+	for (struct dirent *entry; (entry = readdir(dir));) {
+		const char *name = entry->d_name;
+		if (!indexed && strcmp(name, bare) == 0) {
+			max = MAX(max, 0);
+			continue;
+		}
+
+		if (strncmp(name, prefix, prefix_len) != 0 || !isdigit((u8) name[prefix_len])) continue;
+
+		char *end;
+		const u64 index = strtoull(name + prefix_len, &end, 10);
+		if (strcmp(end, suffix) == 0 && index < INT64_MAX) {
+			max = MAX(max, (i64) index);
+		}
+	}
+
+	closedir(dir);
+	return max;
+}
+
+// Writes the path of the name with `index` into the scratch buffer
+static char *format_output_file_path(u64 index)
+{
+	char prefix[OUTPUT_NAME_CAP], suffix[OUTPUT_NAME_CAP];
+	output_name_parts(prefix, suffix, sizeof(prefix));
+
+	scratch_buffer_clear();
+	if (output_dir) scratch_buffer_printf("%s/", output_dir);
+
+	if (index == 0 && !strstr(output_name, OUTPUT_NAME_INDEX)) {
+		scratch_buffer_printf("%s%s", output_name, output_format->extension);
+	} else {
+		scratch_buffer_printf("%s%llu%s", prefix, (unsigned long long) index, suffix);
+	}
+
+	return scratch_buffer_to_string();
+}
+
+// Creates the next free file and returns its path from the scratch buffer,
+// or NULL if it can't. The directory is scanned for the highest index once,
+// later names are counted up from there, and `O_EXCL` makes sure that
+// a name another instance took in the meantime is skipped, not overwritten.
+static char *claim_output_file_path(void)
+{
+	if (output_fd >= 0 || handoff_path[0] || clipboard_mode) return output_target_name;
+
+	if (next_output_index < 0) {
+		next_output_index = scan_output_dir() + 1;
+	}
+
+	for (;;) {
+		char *file_path = format_output_file_path((u64) next_output_index++);
+
+		const int fd = open(file_path, O_CREAT | O_EXCL | O_WRONLY, 0666);
+		if (fd >= 0) {
+			close(fd);
+			return file_path;
+		}
+
+		if (errno != EEXIST) {
+			eprintf("could not create `%s`: %s\n", file_path, strerror(errno));
+			return NULL;
+		}
+	}
+}
+
+// Alpha-blends `n` RGBA canvas pixels over BGRX `dst`
+INLINE static void blend_canvas_row(BGRX *dst, const Color *src, i32 n)
+{
+	for (i32 x = 0; x < n; x++) {
+		const u32 a = src[x].a;
+		if (a == 0) continue;
+
+		dst[x].r = (src[x].r*a + dst[x].r*(0xFF - a)) / 0xFF;
+		dst[x].g = (src[x].g*a + dst[x].g*(0xFF - a)) / 0xFF;
+		dst[x].b = (src[x].b*a + dst[x].b*(0xFF - a)) / 0xFF;
+	}
+}
+
+// Copies the dirty part of the canvas out of the latest readback, which
+// is only started here if no stroke ended since the last change. Must run
+// on the GL thread.
+static CanvasPixels read_canvas_pixels(void)
+{
+	CanvasReadback *rb = &canvas_readback;
+	if (!canvas_dirty.w) return (CanvasPixels) {0};
+
+	STATS_BEGIN(readback);
+
+	if (!rb->issued[rb->latest] || rb->generation[rb->latest] != canvas_generation) {
+		start_canvas_readback();
+	}
+
+	const u32 slot = rb->latest;
+	if (rb->fence[slot]) {
+		while (glClientWaitSync(rb->fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+														1000000000ull) == GL_TIMEOUT_EXPIRED);
+		drop_canvas_readback_fence(slot);
+	}
+
+	const region_t rect = rb->rect[slot];
+	const usize size = (usize) rect.w*rect.h*sizeof(Color);
+	CanvasPixels pixels = {
+		.pixels = (Color *) malloc(size),
+		.rect = rect,
+		.tiles = (u64 *) malloc(canvas_tiles_size()),
+		.tiles_x = canvas_tiles_x
+	};
+	STATS_ALLOC(size);
+	STATS_ALLOC(canvas_tiles_size());
+	STATS_COUNT(canvas_tiles, canvas_tiles_touched);
+	memcpy(pixels.tiles, canvas_tiles, canvas_tiles_size());
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo[slot]);
+	const Color *mapped = (const Color *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (!mapped) {
+		panic("could not map the canvas readback buffer\n");
+	}
+
+	CANVAS_DIRTY_TILE_ROWS(ty) {
+		region_t run;
+		for (u32 tx = 0; next_canvas_tile_run(ty, &tx, &run);) {
+			const usize row = canvas_readback_row(rect, run);
+			for (usize i = row*rect.w + (run.x - rect.x); i < (row + run.h)*rect.w; i += rect.w) {
+				memcpy(pixels.pixels + i, mapped + i, run.w*sizeof(Color));
+			}
+		}
+	}
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	STATS_END(readback);
+
+	return pixels;
+}
+
+// Claimed files already exist, so they are only opened here
+INLINE static int open_output(const char *file_path)
+{
+	if (output_fd >= 0) return output_fd;
+	return open(file_path, O_WRONLY | O_TRUNC);
+}
+
+INLINE static bool close_output(int fd)
+{
+	if (fd == output_fd) return true;
+	return close(fd) == 0;
+}
+
+// Pipes and sockets may take less than asked for at a time
+static bool write_to_fd(void *ctx, const u8 *data, usize size)
+{
+	const int fd = *(const int *) ctx;
+
+	STATS_BEGIN(write);
+	while (size > 0) {
+		const ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		data += n;
+		size -= n;
+	}
+	STATS_END(write);
+
+	return size == 0;
+}
+
+// Targets the clipboard image is offered as, each one encoded
+// only once some client asks for it
+static const struct {
+	const char *name;
+	encode_fn encode;
+} clipboard_targets[] = {
+	{ "image/png", encode_png },
+	{ "image/bmp", bmp_encode },
+	{ "image/x-portable-pixmap", ppm_encode },
+	{ "image/qoi", qoi_encode }
+};
+
+#define CLIPBOARD_TARGETS_COUNT (sizeof(clipboard_targets) / sizeof(clipboard_targets[0]))
+
+typedef struct {
+	u8 *pixels;
+	u32 w, h;
+	u8 *encoded[CLIPBOARD_TARGETS_COUNT];
+	usize encoded_size[CLIPBOARD_TARGETS_COUNT];
+} ClipboardImage;
+
+// The last save wins, only read once the save queue is drained
+static ClipboardImage clipboard_image = {0};
+
+static void clipboard_store(const u8 *data, int w, int h)
+{
+	free(clipboard_image.pixels);
+	for (u32 i = 0; i < CLIPBOARD_TARGETS_COUNT; i++) {
+		free(clipboard_image.encoded[i]);
+	}
+	clipboard_image = (ClipboardImage) {0};
+
+	const usize size = (usize) w*h*sizeof(BGRX);
+	clipboard_image.pixels = (u8 *) malloc(size);
+	STATS_ALLOC(size);
+	memcpy(clipboard_image.pixels, data, size);
+	clipboard_image.w = w;
+	clipboard_image.h = h;
+}
+
+// Passes a copy of `w`x`h` BGRX `data` on through a fresh memfd
+static bool create_handoff_frame(HandoffFrame *frame, u32 w, u32 h)
+{
+	if (!handoff_frame_create(frame, w, h)) {
+		eprintf("could not create a frame to hand off: %s\n", strerror(errno));
+		return false;
+	}
+	STATS_ALLOC(frame->size);
+	return true;
+}
+
+static void send_handoff_frame(HandoffFrame *frame)
+{
+	STATS_BEGIN(write);
+	if (!handoff_frame_send(frame, handoff_path)) {
+		eprintf("could not hand the frame off to `%s`: %s\n", handoff_path, strerror(errno));
+	}
+	STATS_END(write);
+}
+
+static void handoff_image(const u8 *data, int w, int h)
+{
+	HandoffFrame frame;
+	if (!create_handoff_frame(&frame, w, h)) return;
+
+	memcpy(frame.pixels, data, frame.size);
+	send_handoff_frame(&frame);
+}
+
+static void export_image(const u8 *data, int w, int h, const char *file_path)
+{
+	if (handoff_path[0]) {
+		handoff_image(data, w, h);
+		return;
+	}
+
+	if (clipboard_mode) {
+		clipboard_store(data, w, h);
+		return;
+	}
+
+	int fd = open_output(file_path);
+	if (fd < 0) {
+		eprintf("could not open `%s`: %s\n", file_path, strerror(errno));
+		return;
+	}
+
+	bool written;
+	if (output_format->stream) {
+		// Written as it's encoded, the whole file is never in memory
+		STATS_BEGIN(encode);
+		written = output_format->stream(data, (usize) w*sizeof(BGRX), w, h, write_to_fd, &fd);
+		STATS_END(encode);
+	} else {
+		STATS_BEGIN(encode);
+		usize size = 0;
+		u8 *encoded = output_format->encode(data, (usize) w*sizeof(BGRX), w, h, &size);
+		STATS_END(encode);
+
+		if (!encoded) {
+			eprintf("could not encode `%s`\n", file_path);
+			close_output(fd);
+			return;
+		}
+
+		STATS_ALLOC(size);
+		written = write_to_fd(&fd, encoded, size);
+		free(encoded);
+	}
+
+	if (!close_output(fd)) written = false;
+
+	if (!written) {
+		eprintf("could not write `%s`: %s\n", file_path, strerror(errno));
+	}
+}
+
+INLINE static void save_image_data(u8 *data, int w, int h)
+{
+	const char *file_path = claim_output_file_path();
+	if (!file_path) return;
+
+	export_image(data, w, h, file_path);
+}
+
+// Captures `area` right into the memfd that is handed off, without a copy
+static void handoff_screenshot(Window root, XWindowAttributes gwa, region_t area)
+{
+	HandoffFrame frame;
+	if (!handoff_frame_create(&frame, area.w, area.h)) {
+		panic("could not create a frame to hand off: %s\n", strerror(errno));
+	}
+
+	capture_area(root, gwa, area, frame.pixels);
+
+	STATS_BEGIN(write);
+	const bool sent = handoff_frame_send(&frame, handoff_path);
+	STATS_END(write);
+
+	if (!sent) {
+		panic("could not hand the frame off to `%s`: %s\n", handoff_path, strerror(errno));
+	}
+}
+
+// Bands of a streamed screenshot are this big, give or take a row,
+// so that grabbing them doesn't take too many round trips to the server
+#define STREAM_BAND_BYTES (1 << 20)
+#define STREAM_MIN_BAND_ROWS 16
+
+// Grabs `area` band by band straight into the PNG encoder, so that only a few
+// bands are ever in memory instead of several copies of the whole frame.
+// The next band is grabbed and converted while earlier ones are deflated and
+// written. Monitors are grabbed the same way `capture_screen` does,
+// with the dead space between them left black.
+static void stream_screenshot(Window root, XWindowAttributes gwa, region_t area)
+{
+	const bool whole_screen = area.x == 0 && area.y == 0 &&
+		area.w == (u32) gwa.width && area.h == (u32) gwa.height;
+	const bool per_crtc = whole_screen && crtcs_worth_grabbing(gwa);
+
+	const region_t *rects = per_crtc ? crtcs : &area;
+	const u32 rects_count = per_crtc ? crtcs_count : 1;
+
+	const usize stride = area.w*sizeof(BGRX);
+	const u32 band_rows = MIN(area.h, MAX(STREAM_MIN_BAND_ROWS, STREAM_BAND_BYTES / stride));
+
+	// Every band is grabbed through one segment that fits the widest of them
+	if (shm_available(xdisplay)) {
+		shm_ensure(&shm, gwa, area.w, band_rows);
+	}
+
+	const char *file_path = claim_output_file_path();
+	if (!file_path) exit(1);
+
+	int fd = open_output(file_path);
+	if (fd < 0) {
+		panic("could not open `%s`: %s\n", file_path, strerror(errno));
+	}
+
+	PngStream stream;
+	if (!png_stream_begin(&stream, area.w, area.h, band_rows, png_level, png_threads(), write_to_fd, &fd)) {
+		panic("could not start encoding `%s`\n", file_path);
+	}
+
+	u32 rows = 0;
+	i32 band_y = area.y;
+	for (u8 *band; (band = png_stream_next(&stream, &rows)); band_y += rows) {
+		if (per_crtc) memset(band, 0, rows*stride);
+
+		for (u32 i = 0; i < rects_count; i++) {
+			const region_t r = rects[i];
+			const i32 y0 = MAX(band_y, r.y);
+			const i32 y1 = MIN(band_y + (i32) rows, r.y + (i32) r.h);
+			if (y1 <= y0) continue;
+
+			const region_t rect = {.w = r.w, .h = y1 - y0, .x = r.x, .y = y0};
+
+			STATS_BEGIN(capture);
+			XImage *ximage = grab_ximage_rect(&shm, root, gwa, rect);
+			STATS_END(capture);
+
+			if (!ximage) {
+				panic("could not capture screen using `XGetImage`\n");
+			}
+
+			u8 *dst = band + (y0 - band_y)*stride + (r.x - area.x)*sizeof(BGRX);
+			convert_ximage(ximage, dst, stride);
+			release_ximage(&shm, ximage);
+		}
+
+		png_stream_submit(&stream);
+	}
+
+	bool written = png_stream_end(&stream);
+	if (!close_output(fd)) written = false;
+
+	if (!written) {
+		eprintf("could not write `%s`: %s\n", file_path, strerror(errno));
+	}
+}
+
+INLINE static i32 wrap(i32 x, i32 max)
+{
+	x %= max;
+	if (x < 0) x += max;
+	return x;
+}
+
+// Copies `rect` out of the `img_w`x`img_h` capture into `dst`, wrapping
+// around its edges, and blends the canvas over just the touched tiles
+// of it that are in `rect`
+static void compose_region(u8 *dst, region_t rect,
+													 const u8 *img_data, i32 img_w, i32 img_h,
+													 const CanvasPixels *canvas_pixels)
+{
+	const BGRX *src = (const BGRX *) img_data;
+	const region_t c = canvas_pixels->rect;
+
+	for (u32 row = 0; row < rect.h; row++) {
+		const i32 wy = wrap(rect.y + (i32) row, img_h);
+		BGRX *out = (BGRX *) dst + (usize) row*rect.w;
+
+		// Capture rows match top-down canvas rows, read back bottom-up
+		const Color *canvas_row = canvas_pixels->pixels && wy >= c.y && wy < c.y + (i32) c.h
+			? canvas_pixels->pixels + (usize) (c.y + (i32) c.h - 1 - wy)*c.w
+			: NULL;
+
+		// Only a rect hanging over an edge is split, once per edge it crosses
+		for (u32 col = 0; col < rect.w;) {
+			const i32 wx = wrap(rect.x + (i32) col, img_w);
+			const i32 n = MIN((i32) (rect.w - col), img_w - wx);
+
+			memcpy(out + col, src + (usize) wy*img_w + wx, n*sizeof(BGRX));
+
+			const i32 lo = MAX(wx, c.x);
+			const i32 hi = MIN(wx + n, c.x + (i32) c.w);
+			const u32 tile_row = canvas_row ? wy / CANVAS_TILE_SIZE*canvas_pixels->tiles_x : 0;
+
+			// Tiles nothing was drawn on weren't read back
+			for (i32 x = lo; canvas_row && x < hi;) {
+				const u32 tx = x / CANVAS_TILE_SIZE;
+				const i32 end = MIN(hi, (i32) (tx + 1)*CANVAS_TILE_SIZE);
+				if (canvas_tile_touched(canvas_pixels->tiles, tile_row + tx)) {
+					blend_canvas_row(out + col + (x - wx), canvas_row + (x - c.x), end - x);
+				}
+				x = end;
+			}
+
+			col += n;
+		}
+	}
+}
+
+// A save handed off to the save worker. The job owns `canvas` and
+// `file_path`. `pixels` borrows `original_image_data`, which must not be
+// reused or freed while any save is pending, see `save_queue_idle`.
+typedef struct SaveJob {
+	struct SaveJob *next;
+	const u8 *pixels;
+	i32 pixels_w, pixels_h;
+	CanvasPixels canvas;
+	bool crop;
+	region_t rect;
+	char *file_path;
+} SaveJob;
+
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	SaveJob *head, *tail;
+
+	// Queued or being written, and done since the start
+	u32 pending, finished;
+	u64 last_finished_ns;
+
+	bool started;
+} SaveQueue;
+
+static SaveQueue save_queue = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+
+// Crops, composites, encodes and writes a queued save, then frees it
+static void run_save_job(SaveJob *job)
+{
+	STATS_BEGIN(composite);
+
+	const region_t rect = job->crop
+		? job->rect
+		: (region_t) {.w = job->pixels_w, .h = job->pixels_h};
+
+	// A handed off save is composed right into the memfd the receiver maps
+	HandoffFrame frame = {.fd = -1};
+	u8 *data = NULL;
+	if (handoff_path[0]) {
+		if (create_handoff_frame(&frame, rect.w, rect.h)) data = frame.pixels;
+	} else {
+		const usize size = (usize) rect.w*rect.h*sizeof(BGRX);
+		data = (u8 *) malloc(size);
+		STATS_ALLOC(size);
+	}
+
+	if (data) {
+		compose_region(data, rect,
+									 job->pixels, job->pixels_w, job->pixels_h,
+									 &job->canvas);
+	}
+
+	STATS_END(composite);
+
+	if (frame.pixels) {
+		send_handoff_frame(&frame);
+	} else if (data) {
+		export_image(data, rect.w, rect.h, job->file_path);
+		free(data);
+	}
+
+	free(job->canvas.pixels);
+	free(job->canvas.tiles);
+	free(job->file_path);
+	free(job);
+}
+
+static void *save_worker(void *arg UNUSED)
+{
+	for (;;) {
+		pthread_mutex_lock(&save_queue.mutex);
+		while (!save_queue.head) {
+			pthread_cond_wait(&save_queue.cond, &save_queue.mutex);
+		}
+
+		SaveJob *job = save_queue.head;
+		save_queue.head = job->next;
+		if (!save_queue.head) save_queue.tail = NULL;
+		pthread_mutex_unlock(&save_queue.mutex);
+
+		run_save_job(job);
+
+		pthread_mutex_lock(&save_queue.mutex);
+		save_queue.pending--;
+		save_queue.finished++;
+		save_queue.last_finished_ns = monotonic_ns();
+		pthread_cond_broadcast(&save_queue.cond);
+		pthread_mutex_unlock(&save_queue.mutex);
+	}
+
+	return NULL;
+}
+
+// Snapshots the canvas and hands the rest of the save over to the worker,
+// so that the overlay keeps drawing frames while it's encoded and written.
+// `rect` is what to crop out of the capture when `crop` is set.
+static void queue_save(bool crop, region_t rect)
+{
+	// The name is claimed right away, so that saves queued back to back
+	// don't all get the same one
+	const char *file_path = claim_output_file_path();
+	if (!file_path) return;
+
+	SaveJob *job = (SaveJob *) calloc(1, sizeof(SaveJob));
+	job->pixels = original_image_data;
+	job->pixels_w = screenshot.width;
+	job->pixels_h = screenshot.height;
+	job->canvas = read_canvas_pixels();
+	job->crop = crop;
+	job->rect = rect;
+	job->file_path = strdup(file_path);
+
+	pthread_mutex_lock(&save_queue.mutex);
+	if (save_queue.tail) {
+		save_queue.tail->next = job;
+	} else {
+		save_queue.head = job;
+	}
+	save_queue.tail = job;
+	save_queue.pending++;
+
+	if (!save_queue.started) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, save_worker, NULL) != 0) {
+			panic("could not start the save worker\n");
+		}
+		pthread_detach(thread);
+		save_queue.started = true;
+	}
+
+	pthread_cond_broadcast(&save_queue.cond);
+	pthread_mutex_unlock(&save_queue.mutex);
+}
+
+// Blocks until every queued save is written
+static void save_queue_wait(void)
+{
+	pthread_mutex_lock(&save_queue.mutex);
+	while (save_queue.pending) {
+		pthread_cond_wait(&save_queue.cond, &save_queue.mutex);
+	}
+	pthread_mutex_unlock(&save_queue.mutex);
+}
+
+// Whether no save is queued or being written, i.e. nothing still reads
+// `original_image_data`
+INLINE static bool save_queue_idle(void)
+{
+	pthread_mutex_lock(&save_queue.mutex);
+	const bool idle = !save_queue.pending;
+	pthread_mutex_unlock(&save_queue.mutex);
+	return idle;
+}
+
+INLINE static void get_selection_corners(whxy_t whxy,
+																				 Vector2 *upper_left,
+																				 Vector2 *upper_right,
+																				 Vector2 *bottom_left,
+																				 Vector2 *bottom_right)
+{
+	WHXY_UNPACK
+
+	upper_left->x = x;
+	upper_left->y = y;
+
+	upper_right->x = x + w;
+	upper_right->y = y;
+
+	bottom_left->x = x;
+	bottom_left->y = y + h;
+
+	bottom_right->x = x + w;
+	bottom_right->y = y + h;
+}
+
+static bool selection_check_collisions(Vector2 mouse_pos)
+{
+	const whxy_t whxy = get_selection_data();
+	WHXY_UNPACK
+
+	const Rectangle rec = (Rectangle) {
+		.width = w,
+		.height = h,
+		.x = x,
+		.y = y,
+	};
+
+	return CheckCollisionPointRec(mouse_pos, rec);
+}
+
+static u8 selection_check_corner_collisions(Vector2 mouse_pos)
+{
+	Vector2 up_l, up_r, bot_l, bot_r = {0};
+	get_selection_corners(get_selection_data(),
+												&up_l, &up_r,
+												&bot_l, &bot_r);
+
+	if (CheckCollisionPointCircle(mouse_pos, up_l, RESIZE_RING_RADIUS)) {
+		return SELECTION_UPPER_LEFT;
+	}
+
+	if (CheckCollisionPointCircle(mouse_pos, up_r, RESIZE_RING_RADIUS)) {
+		return SELECTION_UPPER_RIGHT;
+	}
+
+	if (CheckCollisionPointCircle(mouse_pos, bot_l, RESIZE_RING_RADIUS)) {
+		return SELECTION_BOTTOM_LEFT;
+	}
+
+	if (CheckCollisionPointCircle(mouse_pos, bot_r, RESIZE_RING_RADIUS)) {
+		return SELECTION_BOTTOM_RIGHT;
+	}
+
+	return SELECTION_POISONED;
+}
+
+INLINE static Vector2 Vector2Value(float value)
+{
+	return (Vector2) {value, value};
+}
+
+INLINE static Vector2 Vector2DivideValue(Vector2 v, float div)
+{
+	return (Vector2) { v.x / div, v.y / div };
+}
+
+static void take_screenshot(void)
+{
+	if (selection_mode) {
+		const whxy_t whxy = get_selection_data();
+
+		WHXY_UNPACK_I32
+
+		x = fabsf(x - image_pos.x) / zoom;
+		y = fabsf(y - image_pos.y) / zoom;
+		w /= zoom;
+		h /= zoom;
+
+		stop_selection_mode();
+		queue_save(true, (region_t) {.w = w, .h = h, .x = x, .y = y});
+	} else {
+		queue_save(false, (region_t) {0});
+	}
+
+	clear_canvas();
+}
 
 static i32 check_color_selector_collisions(Vector2 mouse_pos)
 {
-	const Vector2 rpos = Vector2Add(color_selector_entered_position,
-																	COLOR_SELECTOR_WINDOW_CURSOR_PADDING);
+	const Vector2 rpos = Vector2Add(color_selector_entered_position,
+																	COLOR_SELECTOR_WINDOW_CURSOR_PADDING);
+
+	for (size_t color_idx = 0; color_idx < COLORS_COUNT; color_idx++) {
+		const Vector2 tile_pos = Vector2Add(rpos, COLOR_POSITIONS[color_idx]);
+		const Rectangle tile_rect = (Rectangle) {
+			.x = tile_pos.x, .y = tile_pos.y,
+			.width = COLOR_PREVIEW_SIZE.x, .height = COLOR_PREVIEW_SIZE.y
+		};
+
+		if (CheckCollisionPointRec(mouse_pos, tile_rect)) {
+			return (i32) color_idx;
+		}
+	}
+
+	return -1;
+}
+
+static void handle_input(void)
+{
+	const float wheel_move = GetMouseWheelMove();
+	const Vector2 mouse_pos = GetMousePosition();
+
+	if (!color_selector_mode) {
+		cur_pos = mouse_pos;
+	}
+
+	alt_mode = IsKeyDown(KEY_LEFT_ALT);
+
+	if (color_selector_mode) {
+		ShowCursor();
+		SetMouseCursor(MOUSE_CURSOR_ARROW);
+	} else if (resizing_now) {
+		ShowCursor();
+		SetMouseCursor(MOUSE_CURSOR_RESIZE_ALL);
+	} else if (alt_mode || resize_mode || drawing_now) {
+		ShowCursor();
+		SetMouseCursor(MOUSE_CURSOR_CROSSHAIR);
+	} else {
+		HideCursor();
+	}
+
+	if (selection_mode && !resize_mode) {
+		selection_end = cur_pos;
+	}
+
+	// Wait quarter of a second to not draw accidentally
+	if (color_selector_mode_ending != DOUBLE_UNINITIALIZED) {
+		if (GetTime() - color_selector_mode_ending > 0.25) {
+			color_selector_mode_ending = DOUBLE_UNINITIALIZED;
+		} else {
+			return;
+		}
+	}
+
+	if (resizing_now) {
+		if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+			switch (resizing_what) {
+			case SELECTION_INSIDE: {
+				const Vector2 delta = Vector2Subtract(mouse_pos, dmouse_pos);
+				selection_start = Vector2Add(selection_start, delta);
+				selection_end = Vector2Add(selection_end, delta);
+			} break;
+
+			case SELECTION_UPPER_LEFT: {
+				if (mouse_pos.x > 0) {
+					selection_start.x = mouse_pos.x;
+				}
+				selection_start.y = mouse_pos.y;
+			} break;
+
+			case SELECTION_UPPER_RIGHT: {
+				if (mouse_pos.x > 0) {
+					selection_end.x = mouse_pos.x;
+				}
+				selection_start.y = mouse_pos.y;
+			} break;
+
+			case SELECTION_BOTTOM_LEFT: {
+				if (mouse_pos.x > 0) {
+					selection_start.x = mouse_pos.x;
+				}
+				selection_end.y = mouse_pos.y;
+			} break;
+
+			case SELECTION_BOTTOM_RIGHT: {
+				if (mouse_pos.x > 0) {
+					selection_end.x = mouse_pos.x;
+				}
+				selection_end.y = mouse_pos.y;
+			} break;
+
+			default: panic("unreachable"); break;
+			}
+		} else {
+			stop_resizing();
+		}
+	}
+
+	if (!drawing_now && resize_mode && !resizing_now && IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+		const u8 corner = selection_check_corner_collisions(mouse_pos);
+		if (corner != SELECTION_POISONED) {
+			resizing_now = true;
+			resizing_what = corner;
+		} else if (alt_mode && selection_check_collisions(mouse_pos)) {
+			resizing_now = true;
+			resizing_what = SELECTION_INSIDE;
+		}
+	}
+
+	if (!color_selector_mode && !alt_mode && (!resize_mode || (resize_mode && !resizing_now))) {
+		if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+			drawing_now = true;
+			BeginTextureMode(canvas);
+			{
+				const int nsteps = (int) Vector2Distance(dmouse_pos, mouse_pos);
+				for (int step = 0; step < nsteps; step++) {
+					const Vector2 ipos = Vector2Lerp(dmouse_pos,
+																					 mouse_pos,
+																					 (float) step / nsteps);
+
+					const Vector2 center = {(int) ipos.x, (int) ipos.y};
+					DrawCircle(center.x, center.y, brush_radius, brush_color);
+					mark_canvas_tiles(center, brush_radius);
+				}
+			}
+			EndTextureMode();
+		} else if (drawing_now) {
+			drawing_now = false;
+			start_canvas_readback();
+		}
+	}
+
+	if (IsKeyPressed(KEY_ESCAPE)) {
+		stop_timer_mode();
+		if (color_selector_mode) {
+			stop_color_selector_mode();
+		} else if (selection_mode) {
+			stop_resizing();
+			stop_selection_mode();
+		} else {
+			clear_canvas();
+			zoom = STARTING_ZOOM;
+			radius = STARTING_RADIUS;
+			image_pos = Vector2Zero();
+			SetMousePosition(center_x, center_y);
+			cur_pos = (Vector2) {center_x, center_y};
+		}
+	}
+
+	else if (IsKeyPressed(KEY_ENTER)) {
+		take_screenshot();
+	}
+
+	else if (IsKeyPressed(KEY_C)) {
+		clear_canvas();
+	}
+
+	else if (IsKeyPressed(KEY_T)) {
+		timer_mode = true;
+		timer_start = clock();
+	}
+
+	else if (IsKeyPressed(KEY_B)) {
+		if (!color_selector_mode) {
+			color_selector_mode = true;
+			color_selector_entered_position = mouse_pos;
+		} else {
+			stop_color_selector_mode();
+		}
+	}
+
+	if (color_selector_mode && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+		const i32 tile_idx = check_color_selector_collisions(mouse_pos);
+		if (tile_idx >= 0) {
+			color_selector_mode_ending = GetTime();
+			brush_color = colors[tile_idx];
+		}
+		stop_color_selector_mode();
+	}
+
+	if (wheel_move != 0) {
+		if (color_selector_mode) {
+			const float sens = IsKeyDown(KEY_LEFT_SHIFT) ?
+				BOOSTED_BRUSH_RADIUS_SENSITIVITY :
+				BRUSH_RADIUS_SENSITIVITY;
+
+			const float new_brush_radius = brush_radius + wheel_move*sens;
+			brush_radius = Clamp(new_brush_radius, 1.0f, 50.0f);
+		} else if (IsKeyDown(KEY_CAPS_LOCK) || IsKeyDown(KEY_LEFT_CONTROL)) {
+			float offset = -SCROLL_SPEED*wheel_move;
+
+			if (offset <= 0) {
+				offset*=-RADIUS_ZOOM_OUT_FACTOR;
+			}
+
+			const float sine = sin(offset);
+			const float sens = IsKeyDown(KEY_LEFT_SHIFT) ?
+				BOOSTED_SCROLL_SENSITIVITY :
+				SCROLL_SENSITIVITY;
+
+			const float tradius = MIN(MIN(gwa.width, gwa.height), MAX(15.0, radius + sine*sens));
+			radius += (tradius - radius)*SMOOTHING_FACTOR;
+		} else {
+			Vector2 offset = Vector2DivideValue(Vector2Subtract(mouse_pos, image_pos), zoom);
+
+			const float zs = IsKeyDown(KEY_LEFT_SHIFT) ? BOOSTED_ZOOM_SPEED : ZOOM_SPEED;
+			zoom += wheel_move*0.1f*zs;
+			zoom = Clamp(zoom, MIN_ZOOM, MAX_ZOOM);
+
+			image_pos = Vector2Subtract(mouse_pos,
+																	Vector2Multiply(offset, Vector2Value(zoom)));
+		}
+	}
+
+	if (IsKeyDown(KEY_SPACE)) {
+		if (!pan_mode) {
+			pan_mode = true;
+		}
+		Vector2 delta = Vector2Subtract(mouse_pos, dmouse_pos);
+		delta = Vector2Scale(delta, PANNING_FACTOR*(zoom*PANNING_ZOOM_FACTOR));
+		image_pos = Vector2Add(image_pos, delta);
+		cur_pos = mouse_pos;
+	} else {
+		pan_mode = false;
+	}
+
+	if (alt_mode) {
+		if (!selection_mode && IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
+			selection_start = mouse_pos;
+			selection_mode = true;
+		} else if (selection_mode && !IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
+			resize_mode = true;
+		}
+	} else if (selection_mode && !resize_mode) {
+		stop_selection_mode();
+	}
+
+	dmouse_pos = cur_pos;
+}
+
+static void draw_selection(void)
+{
+	if (selection_start.x == DOUBLE_UNINITIALIZED) return;
+	draw_dimmed_screenshot(Vector2Zero(), 0.0f);
+
+	const whxy_t whxy = get_selection_data();
+	WHXY_UNPACK
+
+	const Rectangle selection = {
+		.height = h,
+		.width = w,
+		.x = x,
+		.y = y
+	};
+
+	const Rectangle src_rect = {
+		.x = (x - image_pos.x) / zoom,
+		.y = (y - image_pos.y) / zoom,
+		.width = w / zoom,
+		.height = h / zoom
+	};
+
+	DrawTexturePro(screenshot_texture,
+								 src_rect,
+								 selection,
+								 Vector2Zero(),
+								 0,
+								 WHITE);
+
+	Vector2 up_l, up_r, bot_l, bot_r = {0};
+	get_selection_corners(whxy, &up_l, &up_r, &bot_l, &bot_r);
+
+	DrawRing(up_l,
+					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
+					 RESIZE_RING_RADIUS,
+					 0.0f, 365.0f,
+					 RESIZE_RING_SEGMENTS,
+					 RESIZE_RING_COLOR);
+
+	DrawRing(up_r,
+					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
+					 RESIZE_RING_RADIUS,
+					 0.0f, 365.0f,
+					 RESIZE_RING_SEGMENTS,
+					 RESIZE_RING_COLOR);
+
+	DrawRing(bot_l,
+					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
+					 RESIZE_RING_RADIUS,
+					 0.0f, 365.0f,
+					 RESIZE_RING_SEGMENTS,
+					 RESIZE_RING_COLOR);
+
+	DrawRing(bot_r,
+					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
+					 RESIZE_RING_RADIUS,
+					 0.0f, 365.0f,
+					 RESIZE_RING_SEGMENTS,
+					 RESIZE_RING_COLOR);
+}
+
+static void draw_canvas(void)
+{
+	Rectangle src_rect = {
+		0, 0,
+		(float) canvas.texture.width,
+		(float) -canvas.texture.height
+	};
+
+	Rectangle dst_rec = {
+		0, 0,
+		(float) GetScreenWidth(),
+		(float) GetScreenHeight()
+	};
+
+	Vector2 origin = {0};
+	DrawTexturePro(canvas.texture, src_rect, dst_rec, origin, 0.0f, WHITE);
+}
+
+// Draws `text` on a dark box in the bottom right corner, or the bottom left one
+static void draw_label(const char *text, bool left)
+{
+	// Only labels draw text, so the atlas is uploaded on first use
+	if (!font.texture.id) font = LoadFont_Font();
+
+	const float spacing = 2.0f;
+	const float font_size = 20.0f;
+
+	const Vector2 size = MeasureTextEx(font, text, font_size, spacing);
+
+	const float x = left ? GetScreenWidth()*0.03 : GetScreenWidth()*0.97 - size.x;
+	const float y = GetScreenHeight()*0.97 - size.y;
+
+	const float pad = 50.0f;
+
+	DrawRectangle(x - pad/2,
+								y - pad/2,
+								size.x + pad,
+								size.y + pad,
+								(Color){0, 0, 0, 150});
+
+	DrawTextEx(font,
+						 text,
+						 (Vector2) {x, y},
+						 font_size,
+						 spacing,
+						 WHITE);
+}
+
+static void handle_timer_mode(void)
+{
+	const time_t now = clock();
+	const double elapsed = (double) (now - timer_start) / CLOCKS_PER_SEC;
+	if (elapsed >= 1.0) {
+		stop_timer_mode();
+		take_screenshot();
+		return;
+	}
+
+	scratch_buffer_clear();
+	scratch_buffer_printf("screenshot will be taken "
+												"in %.2lf seconds..",
+												10.0f-elapsed*10.0f);
+
+	draw_label(scratch_buffer_to_string(), false);
+}
+
+// Shows how many saves are still being written, and then briefly that they're done
+static void draw_save_indicator(void)
+{
+	pthread_mutex_lock(&save_queue.mutex);
+	const u32 pending = save_queue.pending;
+	const u64 last_finished_ns = save_queue.last_finished_ns;
+	pthread_mutex_unlock(&save_queue.mutex);
+
+	scratch_buffer_clear();
+	if (pending) {
+		scratch_buffer_printf("saving %u screenshot%s..", pending, pending == 1 ? "" : "s");
+	} else if (last_finished_ns && monotonic_ns() - last_finished_ns < SAVED_INDICATOR_NS) {
+		scratch_buffer_printf("saved");
+	} else {
+		return;
+	}
+
+	draw_label(scratch_buffer_to_string(), true);
+}
+
+static void handle_color_selector_mode(void)
+{
+	const Vector2 rpos = Vector2Add(color_selector_entered_position,
+																	COLOR_SELECTOR_WINDOW_CURSOR_PADDING);
+
+	DrawRectangleV(rpos, COLOR_SELECTOR_WINDOW_SIZE, WHITE);
+
+	for (size_t color_idx = 0; color_idx < COLORS_COUNT; color_idx++) {
+		const Vector2 draw_pos = Vector2Add(rpos, COLOR_POSITIONS[color_idx]);
+		DrawRectangleV(draw_pos, COLOR_PREVIEW_SIZE, colors[color_idx]);
+		DrawRectangleLinesEx((Rectangle) {
+			.x = draw_pos.x, .y = draw_pos.y,
+			.width = COLOR_PREVIEW_SIZE.x, .height = COLOR_PREVIEW_SIZE.y
+		}, 1.0f, BLACK);
+	}
+
+	DrawCircleV(GetMousePosition(),
+							brush_radius,
+							brush_color);
+}
+
+// Captures `area` every `interval_ms`, keeping the frame from the previous
+// capture and patching in only the rectangles XDamage reported since then.
+// Frames nothing was drawn over aren't fetched, encoded nor written at all.
+static void run_interval_capture(Window root, XWindowAttributes gwa, region_t area)
+{
+	int damage_event_base, damage_error_base;
+	if (!XDamageQueryExtension(xdisplay, &damage_event_base, &damage_error_base)) {
+		panic("`interval` mode requires the XDamage extension\n");
+	}
 
-	for (size_t color_idx = 0; color_idx < COLORS_COUNT; color_idx++) {
-		const Vector2 tile_pos = Vector2Add(rpos, COLOR_POSITIONS[color_idx]);
-		const Rectangle tile_rect = (Rectangle) {
-			.x = tile_pos.x, .y = tile_pos.y,
-			.width = COLOR_PREVIEW_SIZE.x, .height = COLOR_PREVIEW_SIZE.y
-		};
+	const Damage damage = XDamageCreate(xdisplay, root, XDamageReportNonEmpty);
+	const XserverRegion parts = XFixesCreateRegion(xdisplay, NULL, 0);
 
-		if (CheckCollisionPointRec(mouse_pos, tile_rect)) {
-			return (i32) color_idx;
+	// Anything drawn from here on, even during the first capture,
+	// gets re-fetched on the next frame
+	XDamageSubtract(xdisplay, damage, None, None);
+	capture_screen(root, gwa, area);
+
+	// Damaged rectangles are grabbed through a segment that fits the whole
+	// area, the first capture may have used per-monitor connections instead
+	if (shm_available(xdisplay)) {
+		shm_ensure(&shm, gwa, area.w, area.h);
+	}
+
+	save_image_data(screenshot.data, screenshot.width, screenshot.height);
+
+	const usize stride = area.w*sizeof(BGRX);
+	const usize frame_size = area.h*stride;
+
+	u32 frames = 1, frames_written = 1;
+	usize bytes_fetched = frame_size, bytes_avoided = 0;
+
+	u64 deadline = monotonic_ns();
+	while (interval_count == 0 || frames < interval_count) {
+		deadline += (u64) interval_ms*1000000ull;
+		sleep_until_ns(deadline);
+		frames++;
+
+		XDamageSubtract(xdisplay, damage, None, parts);
+
+		// The region is read directly, the notifications only have to be
+		// taken off the queue, which would grow for as long as this runs
+		XEvent event;
+		while (XCheckTypedEvent(xdisplay, damage_event_base + XDamageNotify, &event));
+
+		int rects_count = 0;
+		XRectangle *rects = XFixesFetchRegion(xdisplay, parts, &rects_count);
+
+		usize damaged = 0;
+		for (int i = 0; i < rects_count; i++) {
+			const i32 x0 = MAX(area.x, rects[i].x);
+			const i32 y0 = MAX(area.y, rects[i].y);
+			const i32 x1 = MIN(area.x + (i32) area.w, rects[i].x + (i32) rects[i].width);
+			const i32 y1 = MIN(area.y + (i32) area.h, rects[i].y + (i32) rects[i].height);
+			if (x1 <= x0 || y1 <= y0) continue;
+
+			const region_t rect = {.w = x1 - x0, .h = y1 - y0, .x = x0, .y = y0};
+
+			STATS_BEGIN(capture);
+			XImage *ximage = grab_ximage_rect(&shm, root, gwa, rect);
+			STATS_END(capture);
+
+			if (!ximage) {
+				panic("could not capture damaged area %ux%u%+d%+d\n", rect.w, rect.h, rect.x, rect.y);
+			}
+
+			u8 *dst = (u8 *) screenshot.data + (rect.y - area.y)*stride + (rect.x - area.x)*sizeof(BGRX);
+			convert_ximage(ximage, dst, stride);
+			release_ximage(&shm, ximage);
+
+			damaged += rect.w*rect.h*sizeof(BGRX);
 		}
+
+		if (rects) XFree(rects);
+
+		// Overlapping rectangles may add up to more than the frame
+		damaged = MIN(damaged, frame_size);
+		bytes_fetched += damaged;
+		bytes_avoided += frame_size - damaged;
+
+		if (damaged == 0) continue;
+
+		save_image_data(screenshot.data, screenshot.width, screenshot.height);
+		frames_written++;
 	}
 
-	return -1;
+	XFixesDestroyRegion(xdisplay, parts);
+	XDamageDestroy(xdisplay, damage);
+
+	// Frames may be going to stdout themselves
+	FILE *report = output_fd == STDOUT_FILENO ? stderr : stdout;
+	fprintf(report, "%u frames: %u written, %u unchanged and skipped\n",
+					frames, frames_written, frames - frames_written);
+	fprintf(report, "fetched %zu bytes of pixels, avoided %zu bytes\n",
+					bytes_fetched, bytes_avoided);
 }
 
-static void handle_input(void)
+// Resolves negative offsets of the provided region and clips it to the root window
+static region_t resolve_region(XWindowAttributes gwa)
 {
-	const float wheel_move = GetMouseWheelMove();
-	const Vector2 mouse_pos = GetMousePosition();
+	region_t ret = region;
+	if (region_mask & XNegative) ret.x += gwa.width - (i32) ret.w;
+	if (region_mask & YNegative) ret.y += gwa.height - (i32) ret.h;
+
+	const i32 x0 = MAX(0, ret.x);
+	const i32 y0 = MAX(0, ret.y);
+	const i32 x1 = MIN(gwa.width,  ret.x + (i32) ret.w);
+	const i32 y1 = MIN(gwa.height, ret.y + (i32) ret.h);
+
+	if (x1 <= x0 || y1 <= y0) {
+		panic("region %ux%u%+d%+d is outside of the %dx%d screen\n",
+					region.w, region.h, region.x, region.y,
+					gwa.width, gwa.height);
+	}
 
-	if (!color_selector_mode) {
-		cur_pos = mouse_pos;
+	return (region_t) {
+		.w = x1 - x0,
+		.h = y1 - y0,
+		.x = x0,
+		.y = y0
+	};
+}
+
+// Queued saves read `original_image_data` in place instead of copying it,
+// so callers have to `save_queue_wait` before overwriting it here
+INLINE static void preserve_original_image_data(void)
+{
+	assert(save_queue_idle());
+
+	STATS_BEGIN(preserve);
+
+	const usize size = sizeof(BGRX)*screenshot.width*screenshot.height;
+	original_image_data = reuse_buffer(original_image_data,
+																		 &original_image_capacity,
+																		 size);
+
+	memcpy(original_image_data, screenshot.data, size);
+
+	STATS_END(preserve);
+}
+
+static size_t argc;
+#define FLAG_CAP 256
+static char **argv, flag_value[FLAG_CAP + 1];
+
+INLINE static int check_flag(char *flag, bool expect_value)
+{
+	scratch_buffer_clear();
+	scratch_buffer_append(flag);
+	char *lowerflag = scratch_buffer_copy();
+
+	for (size_t i = 1; i < argc; ++i) {
+		if (strcaseeq(lowerflag, argv[i])) {
+			if (!expect_value) return PASSED;
+
+			if (i + 1 >= argc)
+				return PASSED_WITHOUT_VALUE_UNEXPECTEDLY;
+
+			memcpy(flag_value, argv[i + 1], FLAG_CAP);
+			return PASSED;
+		} else {
+			char *pos = strchr(argv[i], '=');
+			if (pos == NULL) continue;
+
+			const size_t idx = pos - argv[i];
+			scratch_buffer_clear();
+			memcpy(scratch_buffer.str, argv[i], idx);
+			scratch_buffer.len = idx;
+			scratch_buffer_append_char('\0');
+
+			const char *flag_str = TextToLower(scratch_buffer.str);
+
+			if (!strcaseeq(lowerflag, flag_str)) continue;
+			if (!expect_value) return PASSED;
+
+			scratch_buffer_clear();
+			scratch_buffer_append(argv[i] + idx + 1);
+			scratch_buffer_append_char('\0');
+
+			// characters after `=`
+			char *flag_value_str = scratch_buffer_to_string();
+
+			if (flag_value_str == NULL || *flag_value_str == '\0')
+				return PASSED_WITHOUT_VALUE_UNEXPECTEDLY;
+
+			memcpy(flag_value, flag_value_str, FLAG_CAP);
+			return PASSED;
+		}
 	}
 
-	alt_mode = IsKeyDown(KEY_LEFT_ALT);
+	return NOT_PASSED;
+}
 
-	if (color_selector_mode) {
-		ShowCursor();
-		SetMouseCursor(MOUSE_CURSOR_ARROW);
-	} else if (resizing_now) {
-		ShowCursor();
-		SetMouseCursor(MOUSE_CURSOR_RESIZE_ALL);
-	} else if (alt_mode || resize_mode || drawing_now) {
-		ShowCursor();
-		SetMouseCursor(MOUSE_CURSOR_CROSSHAIR);
+INLINE static Color color_try_from_str(const char *str)
+{
+	const size_t len = strlen(str);
+	const char *upper_str = TextToUpper(str);
+	if (is_color(upper_str, len) == NULL) {
+		return BLANK;
 	} else {
-		HideCursor();
+		return color_map[hash(upper_str, len)];
 	}
+}
 
-	if (selection_mode && !resize_mode) {
-		selection_end = cur_pos;
+INLINE static float parse_float_or_panic(const char *str)
+{
+	char *end;
+	const float ret = strtof(str, &end);
+	if (end == flag_value || *end != '\0') {
+		panic("failed to parse `%s` to float\n", str);
+	} else if (errno == ERANGE) {
+		if (ret == HUGE_VAL) {
+			panic("overflew when tried to parse `%s` to float\n", str);
+		} else {
+			panic("underflew when tried to parse `%s` to float\n", str);
+		}
 	}
+	return ret;
+}
 
-	// Wait quarter of a second to not draw accidentally
-	if (color_selector_mode_ending != DOUBLE_UNINITIALIZED) {
-		if (GetTime() - color_selector_mode_ending > 0.25) {
-			color_selector_mode_ending = DOUBLE_UNINITIALIZED;
-		} else {
-			return;
+INLINE static void provided_flag_example(const char *flag)
+{
+	printf("try to provide a flag following way:\n");
+	printf("%s=<value> or %s <value>\n", flag, flag);
+}
+
+static void handle_flags(void)
+{
+	int code;
+
+	code = check_flag(IMMEDIATE_SCREENSHOT_AND_EXIT_FLAG, false);
+	if (code == PASSED) {
+		immediate_screenshot_and_exit = true;
+	}
+
+	code = check_flag("daemon", false);
+	if (code == PASSED) {
+		if (immediate_screenshot_and_exit) {
+			panic("`daemon` and `%s` flags can't be used together, trigger the daemon with `trigger=%s` instead\n",
+						IMMEDIATE_SCREENSHOT_AND_EXIT_FLAG, DAEMON_COMMAND_SCREENSHOT);
 		}
+		daemon_mode = true;
 	}
 
-	if (resizing_now) {
-		if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-			switch (resizing_what) {
-			case SELECTION_INSIDE: {
-				const Vector2 delta = Vector2Subtract(mouse_pos, dmouse_pos);
-				selection_start = Vector2Add(selection_start, delta);
-				selection_end = Vector2Add(selection_end, delta);
-			} break;
+	code = check_flag("brush_color", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `brush_color` flag to have a value\n");
+	} else if (code == PASSED) {
+		const Color new_brush_color = color_try_from_str(flag_value);
+		if (memcmp(&new_brush_color, &BLANK, sizeof(Color)) == 0) {
+			eprintf("unexpected color: `%s`\n", flag_value);
+			provided_flag_example("brush_color");
+			exit(1);
+		}
 
-			case SELECTION_UPPER_LEFT: {
-				if (mouse_pos.x > 0) {
-					selection_start.x = mouse_pos.x;
-				}
-				selection_start.y = mouse_pos.y;
-			} break;
+		brush_color = new_brush_color;
+	}
 
-			case SELECTION_UPPER_RIGHT: {
-				if (mouse_pos.x > 0) {
-					selection_end.x = mouse_pos.x;
-				}
-				selection_start.y = mouse_pos.y;
-			} break;
+	code = check_flag("brush_radius", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `brush_radius` flag to have a value\n");
+	} else if (code == PASSED) {
+		brush_radius = parse_float_or_panic(flag_value);
+	}
 
-			case SELECTION_BOTTOM_LEFT: {
-				if (mouse_pos.x > 0) {
-					selection_start.x = mouse_pos.x;
-				}
-				selection_end.y = mouse_pos.y;
-			} break;
+	// Before `region`, which `interval` mode takes too
+	code = check_flag("interval", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `interval` flag to have a value\n");
+	} else if (code == PASSED) {
+		char *end;
+		const long n = strtol(flag_value, &end, 10);
+		if (end == flag_value || *end != '\0' || n < 1) {
+			eprintf("expected `interval` to be a positive number of milliseconds, got: `%s`\n", flag_value);
+			provided_flag_example("interval");
+			exit(1);
+		}
+		if (daemon_mode) {
+			panic("`interval` and `daemon` flags can't be used together\n");
+		}
+		interval_ms = (u32) n;
+	}
 
-			case SELECTION_BOTTOM_RIGHT: {
-				if (mouse_pos.x > 0) {
-					selection_end.x = mouse_pos.x;
-				}
-				selection_end.y = mouse_pos.y;
-			} break;
+	code = check_flag("count", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `count` flag to have a value\n");
+	} else if (code == PASSED) {
+		char *end;
+		const long n = strtol(flag_value, &end, 10);
+		if (end == flag_value || *end != '\0' || n < 0) {
+			eprintf("expected `count` to be a number of frames, got: `%s`\n", flag_value);
+			provided_flag_example("count");
+			exit(1);
+		}
+		if (interval_ms == 0) {
+			panic("`count` flag only makes sense together with `interval`\n");
+		}
+		interval_count = (u32) n;
+	}
+
+	code = check_flag("region", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `region` flag to have a value\n");
+	} else if (code == PASSED) {
+		int x, y;
+		unsigned w, h;
+		region_mask = XParseGeometry(flag_value, &x, &y, &w, &h);
+		if (!(region_mask & WidthValue) || !(region_mask & HeightValue) || w == 0 || h == 0) {
+			eprintf("unexpected region: `%s`, expected `WxH+X+Y`\n", flag_value);
+			provided_flag_example("region");
+			exit(1);
+		}
+
+		if (!immediate_screenshot_and_exit && !daemon_mode && !interval_ms) {
+			panic("`region` flag is only supported in `%s`, `daemon` and `interval` modes\n",
+						IMMEDIATE_SCREENSHOT_AND_EXIT_FLAG);
+		}
+
+		region = (region_t) {.w = w, .h = h, .x = x, .y = y};
+		region_provided = true;
+	}
+
+	code = check_flag("monitor", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `monitor` flag to have a value\n");
+	} else if (code == PASSED) {
+		char *end;
+		const long n = strtol(flag_value, &end, 10);
+		if (strcaseeq(flag_value, "cursor")) {
+			monitor_idx = MONITOR_UNDER_CURSOR;
+		} else if (strcaseeq(flag_value, "all")) {
+			monitor_idx = MONITOR_ALL;
+		} else if (end != flag_value && *end == '\0' && n >= 0 && n < MAX_CRTCS) {
+			monitor_idx = (i32) n;
+		} else {
+			eprintf("unexpected monitor: `%s`, expected its index, `cursor` or `all`\n", flag_value);
+			provided_flag_example("monitor");
+			exit(1);
+		}
+
+		if (region_provided && monitor_idx != MONITOR_ALL) {
+			panic("`monitor` and `region` flags can't be used together\n");
+		}
+	}
+
+	code = check_flag("threads", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `threads` flag to have a value\n");
+	} else if (code == PASSED) {
+		char *end;
+		const long n = strtol(flag_value, &end, 10);
+		if (end == flag_value || *end != '\0' || n < 1) {
+			eprintf("expected `threads` to be a positive number, got: `%s`\n", flag_value);
+			provided_flag_example("threads");
+			exit(1);
+		}
+		threads_count = (u32) n;
+	}
+
+	code = check_flag("png_threads", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `png_threads` flag to have a value\n");
+	} else if (code == PASSED) {
+		char *end;
+		const long n = strtol(flag_value, &end, 10);
+		if (end == flag_value || *end != '\0' || n < 1) {
+			eprintf("expected `png_threads` to be a positive number, got: `%s`\n", flag_value);
+			provided_flag_example("png_threads");
+			exit(1);
+		}
+		png_threads_count = (u32) n;
+	}
+
+	code = check_flag("png_level", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `png_level` flag to have a value\n");
+	} else if (code == PASSED) {
+		char *end;
+		const long n = strtol(flag_value, &end, 10);
+		if (end == flag_value || *end != '\0' || n < 0 || n > 9) {
+			eprintf("expected `png_level` to be a number from 0 to 9, got: `%s`\n", flag_value);
+			provided_flag_example("png_level");
+			exit(1);
+		}
+		png_level = (int) n;
+	}
 
-			default: panic("unreachable"); break;
+	code = check_flag("format", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `format` flag to have a value\n");
+	} else if (code == PASSED) {
+		output_format = NULL;
+		for (u32 i = 0; i < OUTPUT_FORMATS_COUNT; i++) {
+			if (strcaseeq(flag_value, output_formats[i].name)) {
+				output_format = &output_formats[i];
+				break;
 			}
-		} else {
-			stop_resizing();
+		}
+		if (!output_format) {
+			eprintf("unexpected `format`: `%s`, expected `png`, `qoi`, `ppm` or `bmp`\n", flag_value);
+			provided_flag_example("format");
+			exit(1);
 		}
 	}
 
-	if (!drawing_now && resize_mode && !resizing_now && IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-		const u8 corner = selection_check_corner_collisions(mouse_pos);
-		if (corner != SELECTION_POISONED) {
-			resizing_now = true;
-			resizing_what = corner;
-		} else if (alt_mode && selection_check_collisions(mouse_pos)) {
-			resizing_now = true;
-			resizing_what = SELECTION_INSIDE;
+	code = check_flag("output_dir", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `output_dir` flag to have a value\n");
+	} else if (code == PASSED) {
+		struct stat st;
+		if (stat(flag_value, &st) != 0 || !S_ISDIR(st.st_mode)) {
+			panic("`output_dir` `%s` is not a directory\n", flag_value);
 		}
+		scratch_buffer_clear();
+		scratch_buffer_append(flag_value);
+		output_dir = scratch_buffer_copy();
 	}
 
-	if (!color_selector_mode && !alt_mode && (!resize_mode || (resize_mode && !resizing_now))) {
-		if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-			drawing_now = true;
-			BeginTextureMode(canvas);
-			{
-				const int nsteps = (int) Vector2Distance(dmouse_pos, mouse_pos);
-				for (int step = 0; step < nsteps; step++) {
-					const Vector2 ipos = Vector2Lerp(dmouse_pos,
-																					 mouse_pos,
-																					 (float) step / nsteps);
+	// `name` is a template where `%n` stands for the index, `screenshot`
+	// alone means `screenshot.png`, then `screenshot_1.png` and so on
+	code = check_flag("name", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `name` flag to have a value\n");
+	} else if (code == PASSED) {
+		const char *marker = strstr(flag_value, OUTPUT_NAME_INDEX);
+		if (flag_value[0] == '\0' || strchr(flag_value, '/') ||
+				(marker && strstr(marker + 1, OUTPUT_NAME_INDEX))) {
+			eprintf("unexpected `name`: `%s`, expected a file name with at most one `%s` in it\n",
+							flag_value,
+							OUTPUT_NAME_INDEX);
+			provided_flag_example("name");
+			exit(1);
+		}
+		scratch_buffer_clear();
+		scratch_buffer_append(flag_value);
+		output_name = scratch_buffer_copy();
+	}
 
-					DrawCircle((int) ipos.x, (int) ipos.y, brush_radius, brush_color);
-				}
-			}
-			EndTextureMode();
-		} else if (drawing_now) {
-			drawing_now = false;
+	code = check_flag("output", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `output` flag to have a value\n");
+	} else if (code == PASSED) {
+		if (!streq(flag_value, "-")) {
+			eprintf("unexpected `output`: `%s`, expected `-` for stdout, "
+							"use `output_dir` and `name` for files\n", flag_value);
+			provided_flag_example("output");
+			exit(1);
 		}
+		output_fd = STDOUT_FILENO;
+		snprintf(output_target_name, sizeof(output_target_name), "stdout");
 	}
 
-	if (IsKeyPressed(KEY_ESCAPE)) {
-		stop_timer_mode();
-		if (color_selector_mode) {
-			stop_color_selector_mode();
-		} else if (selection_mode) {
-			stop_resizing();
-			stop_selection_mode();
-		} else {
-			clear_canvas();
-			zoom = STARTING_ZOOM;
-			radius = STARTING_RADIUS;
-			image_pos = Vector2Zero();
-			SetMousePosition(center_x, center_y);
-			cur_pos = (Vector2) {center_x, center_y};
+	code = check_flag("output_fd", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `output_fd` flag to have a value\n");
+	} else if (code == PASSED) {
+		char *end;
+		const long n = strtol(flag_value, &end, 10);
+		if (end == flag_value || *end != '\0' || n < 0 || n > INT32_MAX) {
+			eprintf("expected `output_fd` to be a file descriptor number, got: `%s`\n", flag_value);
+			provided_flag_example("output_fd");
+			exit(1);
 		}
+		if (fcntl((int) n, F_GETFL) == -1) {
+			panic("`output_fd` %ld is not an open file descriptor\n", n);
+		}
+		output_fd = (int) n;
+		snprintf(output_target_name, sizeof(output_target_name), "fd %ld", n);
 	}
 
-	else if (IsKeyPressed(KEY_ENTER)) {
-		take_screenshot();
+	code = check_flag("handoff", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `handoff` flag to have a value\n");
+	} else if (code == PASSED) {
+		if (strlen(flag_value) >= sizeof(handoff_path)) {
+			panic("`handoff` socket path is longer than %zu bytes\n", sizeof(handoff_path) - 1);
+		}
+		if (output_fd >= 0) {
+			panic("`handoff` flag can't be combined with `output` or `output_fd`\n");
+		}
+		strcpy(handoff_path, flag_value);
+		snprintf(output_target_name, sizeof(output_target_name), "%s", handoff_path);
 	}
 
-	else if (IsKeyPressed(KEY_C)) {
-		clear_canvas();
+	if (output_fd >= 0 && daemon_mode) {
+		panic("`output` and `output_fd` flags are not supported in `daemon` mode\n");
 	}
 
-	else if (IsKeyPressed(KEY_T)) {
-		timer_mode = true;
-		timer_start = clock();
+	code = check_flag("clipboard", false);
+	if (code == PASSED) {
+		if (daemon_mode || interval_ms) {
+			panic("`clipboard` flag is not supported in `daemon` and `interval` modes\n");
+		}
+		if (output_fd >= 0 || handoff_path[0]) {
+			panic("`clipboard` flag can't be combined with `output`, `output_fd` or `handoff`\n");
+		}
+		clipboard_mode = true;
+		snprintf(output_target_name, sizeof(output_target_name), "clipboard");
 	}
 
-	else if (IsKeyPressed(KEY_B)) {
-		if (!color_selector_mode) {
-			color_selector_mode = true;
-			color_selector_entered_position = mouse_pos;
+	code = check_flag("shm", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `shm` flag to have a value\n");
+	} else if (code == PASSED) {
+		if (strcaseeq(flag_value, "on")) {
+			shm_mode = SHM_ON;
+		} else if (strcaseeq(flag_value, "off")) {
+			shm_mode = SHM_OFF;
+		} else if (strcaseeq(flag_value, "auto")) {
+			shm_mode = SHM_AUTO;
 		} else {
-			stop_color_selector_mode();
+			eprintf("unexpected `shm` mode: `%s`, expected `on`, `off` or `auto`\n", flag_value);
+			provided_flag_example("shm");
+			exit(1);
 		}
 	}
 
-	if (color_selector_mode && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-		const i32 tile_idx = check_color_selector_collisions(mouse_pos);
-		if (tile_idx >= 0) {
-			color_selector_mode_ending = GetTime();
-			brush_color = colors[tile_idx];
+	code = check_flag("socket", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `socket` flag to have a value\n");
+	} else if (code == PASSED) {
+		if (strlen(flag_value) >= sizeof(socket_path)) {
+			panic("`socket` path is longer than %zu bytes\n", sizeof(socket_path) - 1);
 		}
-		stop_color_selector_mode();
+		strcpy(socket_path, flag_value);
 	}
 
-	if (wheel_move != 0) {
-		if (color_selector_mode) {
-			const float sens = IsKeyDown(KEY_LEFT_SHIFT) ?
-				BOOSTED_BRUSH_RADIUS_SENSITIVITY :
-				BRUSH_RADIUS_SENSITIVITY;
-
-			const float new_brush_radius = brush_radius + wheel_move*sens;
-			brush_radius = Clamp(new_brush_radius, 1.0f, 50.0f);
-		} else if (IsKeyDown(KEY_CAPS_LOCK) || IsKeyDown(KEY_LEFT_CONTROL)) {
-			float offset = -SCROLL_SPEED*wheel_move;
+	code = check_flag("hotkey", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
+		panic("expected `hotkey` flag to have a value\n");
+	} else if (code == PASSED) {
+		hotkey = XStringToKeysym(flag_value);
+		if (hotkey == NoSymbol) {
+			eprintf("unexpected hotkey: `%s`, expected a keysym name like `Print` or `F12`\n", flag_value);
+			provided_flag_example("hotkey");
+			exit(1);
+		}
+		if (!daemon_mode) {
+			panic("`hotkey` flag is only supported in `daemon` mode\n");
+		}
+	}
 
-			if (offset <= 0) {
-				offset*=-RADIUS_ZOOM_OUT_FACTOR;
+	// `stats` alone prints a table, `stats=json` a single JSON object. The
+	// value only counts after `=`, so `stats screenshot` still takes a screenshot
+	code = check_flag("stats", false);
+	if (code == PASSED) {
+		if (!STATS) {
+			panic("`stats` flag needs a build with STATS enabled\n");
+		}
+		stats_requested = true;
+
+		for (size_t i = 1; i < argc; ++i) {
+			if (strncasecmp(argv[i], "stats=", 6) != 0) continue;
+			if (!strcaseeq(argv[i] + 6, "json")) {
+				eprintf("unexpected `stats` format: `%s`, expected `json`\n", argv[i] + 6);
+				printf("try to provide a flag following way:\n");
+				printf("stats or stats=json\n");
+				exit(1);
 			}
+			stats_json = true;
+		}
+	}
 
-			const float sine = sin(offset);
-			const float sens = IsKeyDown(KEY_LEFT_SHIFT) ?
-				BOOSTED_SCROLL_SENSITIVITY :
-				SCROLL_SENSITIVITY;
-
-			const float tradius = MIN(MIN(gwa.width, gwa.height), MAX(15.0, radius + sine*sens));
-			radius += (tradius - radius)*SMOOTHING_FACTOR;
+	// `trigger` alone asks for an overlay, even when followed by other flags
+	code = check_flag("trigger", true);
+	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY || (code == PASSED && strchr(flag_value, '='))) {
+		trigger_command = DAEMON_COMMAND_OVERLAY;
+	} else if (code == PASSED) {
+		if (strcaseeq(flag_value, DAEMON_COMMAND_OVERLAY)) {
+			trigger_command = DAEMON_COMMAND_OVERLAY;
+		} else if (strcaseeq(flag_value, DAEMON_COMMAND_SCREENSHOT)) {
+			trigger_command = DAEMON_COMMAND_SCREENSHOT;
+		} else if (strcaseeq(flag_value, DAEMON_COMMAND_QUIT)) {
+			trigger_command = DAEMON_COMMAND_QUIT;
 		} else {
-			Vector2 offset = Vector2DivideValue(Vector2Subtract(mouse_pos, image_pos), zoom);
-
-			const float zs = IsKeyDown(KEY_LEFT_SHIFT) ? BOOSTED_ZOOM_SPEED : ZOOM_SPEED;
-			zoom += wheel_move*0.1f*zs;
-			zoom = Clamp(zoom, MIN_ZOOM, MAX_ZOOM);
-
-			image_pos = Vector2Subtract(mouse_pos,
-																	Vector2Multiply(offset, Vector2Value(zoom)));
+			eprintf("unexpected `trigger` command: `%s`, expected `%s`, `%s` or `%s`\n",
+							flag_value,
+							DAEMON_COMMAND_OVERLAY,
+							DAEMON_COMMAND_SCREENSHOT,
+							DAEMON_COMMAND_QUIT);
+			provided_flag_example("trigger");
+			exit(1);
+		}
+		if (daemon_mode) {
+			panic("`trigger` and `daemon` flags can't be used together\n");
 		}
 	}
+}
 
-	if (IsKeyDown(KEY_SPACE)) {
-		if (!pan_mode) {
-			pan_mode = true;
-		}
-		Vector2 delta = Vector2Subtract(mouse_pos, dmouse_pos);
-		delta = Vector2Scale(delta, PANNING_FACTOR*(zoom*PANNING_ZOOM_FACTOR));
-		image_pos = Vector2Add(image_pos, delta);
-		cur_pos = mouse_pos;
+// Uploads the capture, the textures are kept between daemon overlays
+// and only recreated when the size of the capture changes
+static void load_overlay_textures(void)
+{
+	STATS_BEGIN(upload);
+
+	if (screenshot_texture.id &&
+			screenshot_texture.width == screenshot.width &&
+			screenshot_texture.height == screenshot.height) {
+		UpdateTexture(screenshot_texture, screenshot.data);
 	} else {
-		pan_mode = false;
+		if (screenshot_texture.id) UnloadTexture(screenshot_texture);
+		screenshot_texture = LoadTextureFromImage(screenshot);
+		swizzle_bgrx_texture(screenshot_texture);
 	}
 
-	if (alt_mode) {
-		if (!selection_mode && IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
-			selection_start = mouse_pos;
-			selection_mode = true;
-		} else if (selection_mode && !IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
-			resize_mode = true;
-		}
-	} else if (selection_mode && !resize_mode) {
-		stop_selection_mode();
+	if (!canvas.id ||
+			canvas.texture.width != screenshot.width ||
+			canvas.texture.height != screenshot.height) {
+		if (canvas.id) UnloadRenderTexture(canvas);
+		canvas = LoadRenderTexture(screenshot.width, screenshot.height);
+		reset_canvas();
 	}
 
-	dmouse_pos = cur_pos;
+	clear_canvas();
+
+	STATS_END(upload);
 }
 
-static void draw_selection(void)
+// Runs the overlay until its window is closed. When `trigger_ns` isn't 0,
+// the time from it to the first presented frame is reported to stderr
+// and to `client_fd`, unless that's -1.
+static void run_overlay(u64 trigger_ns, int client_fd)
 {
-	if (selection_start.x == DOUBLE_UNINITIALIZED) return;
-	DrawTextureEx(darker_screenshot_texture,
-								image_pos,
-								0,
-								zoom,
-								WHITE);
+	bool first_frame = true;
 
-	const whxy_t whxy = get_selection_data();
-	WHXY_UNPACK
+	while (!WindowShouldClose()) {
+		handle_input();
+		BeginDrawing();
+		{
+			ClearBackground(BACKGROUND_COLOR);
+			if (selection_mode) {
+				draw_selection();
+			} else if (alt_mode || drawing_now || color_selector_mode) {
+				DrawTextureEx(screenshot_texture,
+											image_pos,
+											0,
+											zoom,
+											WHITE);
 
-	const Rectangle selection = {
-		.height = h,
-		.width = w,
-		.x = x,
-		.y = y
-	};
+			} else {
+				draw_dimmed_screenshot(cur_pos, radius);
+			}
 
-	const Rectangle src_rect = {
-		.x = (x - image_pos.x) / zoom,
-		.y = (y - image_pos.y) / zoom,
-		.width = w / zoom,
-		.height = h / zoom
-	};
+			draw_canvas();
 
-	DrawTexturePro(screenshot_texture,
-								 src_rect,
-								 selection,
-								 Vector2Zero(),
-								 0,
-								 WHITE);
+			if (timer_mode) {
+				handle_timer_mode();
+			}
 
-	Vector2 up_l, up_r, bot_l, bot_r = {0};
-	get_selection_corners(whxy, &up_l, &up_r, &bot_l, &bot_r);
+			if (color_selector_mode) {
+				handle_color_selector_mode();
+			}
 
-	DrawRing(up_l,
-					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
-					 RESIZE_RING_RADIUS,
-					 0.0f, 365.0f,
-					 RESIZE_RING_SEGMENTS,
-					 RESIZE_RING_COLOR);
+			draw_save_indicator();
+		}
+		EndDrawing();
 
-	DrawRing(up_r,
-					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
-					 RESIZE_RING_RADIUS,
-					 0.0f, 365.0f,
-					 RESIZE_RING_SEGMENTS,
-					 RESIZE_RING_COLOR);
+		if (first_frame && trigger_ns) {
+			const double ms = (monotonic_ns() - trigger_ns) / 1e6;
+			eprintf("first frame after %.2f ms\n", ms);
+			if (client_fd >= 0) dprintf(client_fd, "first frame after %.2f ms\n", ms);
+		}
+		first_frame = false;
+	}
+}
 
-	DrawRing(bot_l,
-					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
-					 RESIZE_RING_RADIUS,
-					 0.0f, 365.0f,
-					 RESIZE_RING_SEGMENTS,
-					 RESIZE_RING_COLOR);
+// Puts everything `handle_input` touches back to how a fresh process starts
+static void reset_overlay_state(Color initial_brush_color, float initial_brush_radius)
+{
+	brush_color = initial_brush_color;
+	brush_radius = initial_brush_radius;
+
+	zoom = STARTING_ZOOM;
+	radius = STARTING_RADIUS;
+
+	resizing_now = drawing_now = false;
+	resizing_what = SELECTION_POISONED;
+
+	timer_mode = false;
+	timer_start = 0;
+
+	pan_mode = alt_mode = selection_mode = resize_mode = false;
+
+	color_selector_mode = false;
+	color_selector_mode_ending = DOUBLE_UNINITIALIZED;
+	color_selector_entered_position = (Vector2) {DOUBLE_UNINITIALIZED, DOUBLE_UNINITIALIZED};
+
+	selection_start = selection_end = (Vector2) {DOUBLE_UNINITIALIZED, DOUBLE_UNINITIALIZED};
+
+	image_pos = dmouse_pos = Vector2Zero();
+	SetMousePosition(center_x, center_y);
+	cur_pos = (Vector2) {center_x, center_y};
+}
+
+// Past this size replies go out in INCR chunks, also the size of each chunk
+#define CLIPBOARD_MAX_CHUNK (256*1024)
+#define CLIPBOARD_MAX_TRANSFERS 16
+// Requestors that stop taking chunks are given up on after this long
+#define CLIPBOARD_TRANSFER_TIMEOUT_NS 10000000000ull
+
+typedef struct {
+	Window requestor;
+	Atom property, target;
+	const u8 *data;
+	usize size, offset;
+	u64 last_activity_ns;
+} ClipboardTransfer;
+
+typedef struct {
+	Window window;
+	Time timestamp;
+	Atom clipboard, targets, timestamp_atom, incr;
+	Atom image_targets[CLIPBOARD_TARGETS_COUNT];
+	usize chunk_size;
+	ClipboardTransfer transfers[CLIPBOARD_MAX_TRANSFERS];
+	u32 transfers_count;
+} ClipboardOwner;
+
+// Requestors may go away at any moment, which is no reason to exit
+static int clipboard_error_handler(Display *display UNUSED, XErrorEvent *event UNUSED)
+{
+	return 0;
+}
+
+// A server timestamp to take the selection with, ICCCM asks not to use CurrentTime
+static Time server_time(Window window)
+{
+	const Atom atom = XInternAtom(xdisplay, "SS_TIMESTAMP", False);
+	XChangeProperty(xdisplay, window, atom, XA_STRING, 8, PropModeAppend, NULL, 0);
+
+	XEvent event;
+	XWindowEvent(xdisplay, window, PropertyChangeMask, &event);
+	return event.xproperty.time;
+}
+
+static const u8 *clipboard_encoded(u32 target, usize *size)
+{
+	ClipboardImage *image = &clipboard_image;
+	if (!image->encoded[target]) {
+		image->encoded[target] = clipboard_targets[target].encode(image->pixels,
+																															(usize) image->w*sizeof(BGRX),
+																															image->w, image->h,
+																															&image->encoded_size[target]);
+	}
+
+	*size = image->encoded_size[target];
+	return image->encoded[target];
+}
+
+// Puts the next chunk of `transfer` into the requestor's property,
+// returns false once the closing empty chunk went out
+static bool continue_transfer(ClipboardTransfer *transfer)
+{
+	const usize n = MIN(transfer->size - transfer->offset, CLIPBOARD_MAX_CHUNK);
+	XChangeProperty(xdisplay, transfer->requestor, transfer->property, transfer->target,
+									8, PropModeReplace, transfer->data + transfer->offset, (int) n);
+	transfer->offset += n;
+	transfer->last_activity_ns = monotonic_ns();
+	return n > 0;
+}
 
-	DrawRing(bot_r,
-					 RESIZE_RING_RADIUS - RESIZE_RING_THICKNESS,
-					 RESIZE_RING_RADIUS,
-					 0.0f, 365.0f,
-					 RESIZE_RING_SEGMENTS,
-					 RESIZE_RING_COLOR);
+static void end_transfer(ClipboardOwner *owner, u32 idx)
+{
+	XSelectInput(xdisplay, owner->transfers[idx].requestor, NoEventMask);
+	owner->transfers[idx] = owner->transfers[--owner->transfers_count];
 }
 
-static void draw_canvas(void)
+// Answers with the property set, or refuses with None, as ICCCM describes
+static void answer_selection_request(ClipboardOwner *owner, const XSelectionRequestEvent *request)
 {
-	Rectangle src_rect = {
-		0, 0,
-		(float) canvas.texture.width,
-		(float) -canvas.texture.height
+	// Obsolete clients leave the property out and expect the target's name used
+	const Atom property = request->property != None ? request->property : request->target;
+
+	XSelectionEvent reply = {
+		.type = SelectionNotify,
+		.display = request->display,
+		.requestor = request->requestor,
+		.selection = request->selection,
+		.target = request->target,
+		.property = None,
+		.time = request->time
 	};
 
-	Rectangle dst_rec = {
-		0, 0,
-		(float) GetScreenWidth(),
-		(float) GetScreenHeight()
-	};
+	const bool ours = request->selection == owner->clipboard &&
+		(request->time == CurrentTime || request->time >= owner->timestamp);
+
+	if (!ours) {
+		// refused
+	} else if (request->target == owner->targets) {
+		Atom targets[2 + CLIPBOARD_TARGETS_COUNT] = {owner->targets, owner->timestamp_atom};
+		memcpy(targets + 2, owner->image_targets, sizeof(owner->image_targets));
+		XChangeProperty(xdisplay, request->requestor, property, XA_ATOM, 32,
+										PropModeReplace, (const u8 *) targets, 2 + CLIPBOARD_TARGETS_COUNT);
+		reply.property = property;
+	} else if (request->target == owner->timestamp_atom) {
+		const long timestamp = (long) owner->timestamp;
+		XChangeProperty(xdisplay, request->requestor, property, XA_INTEGER, 32,
+										PropModeReplace, (const u8 *) &timestamp, 1);
+		reply.property = property;
+	} else {
+		for (u32 i = 0; i < CLIPBOARD_TARGETS_COUNT; i++) {
+			if (request->target != owner->image_targets[i]) continue;
+
+			usize size = 0;
+			const u8 *data = clipboard_encoded(i, &size);
+			if (!data) break;
+
+			if (size <= owner->chunk_size) {
+				XChangeProperty(xdisplay, request->requestor, property, request->target, 8,
+												PropModeReplace, data, (int) size);
+				reply.property = property;
+			} else if (owner->transfers_count < CLIPBOARD_MAX_TRANSFERS) {
+				// The requestor deletes the INCR property to ask for the first chunk
+				XSelectInput(xdisplay, request->requestor, PropertyChangeMask);
+				const long total = (long) size;
+				XChangeProperty(xdisplay, request->requestor, property, owner->incr, 32,
+												PropModeReplace, (const u8 *) &total, 1);
+
+				owner->transfers[owner->transfers_count++] = (ClipboardTransfer) {
+					.requestor = request->requestor,
+					.property = property,
+					.target = request->target,
+					.data = data,
+					.size = size,
+					.last_activity_ns = monotonic_ns()
+				};
+				reply.property = property;
+			}
+			break;
+		}
+	}
 
-	Vector2 origin = {0};
-	DrawTexturePro(canvas.texture, src_rect, dst_rec, origin, 0.0f, WHITE);
+	XSendEvent(xdisplay, request->requestor, False, NoEventMask, (XEvent *) &reply);
+	XFlush(xdisplay);
 }
 
-static void handle_timer_mode(void)
+// Owns CLIPBOARD with the last saved image until another client takes it
+// over, and finishes the transfers still going on then. Only the image and
+// whatever targets were asked for so far are kept in memory meanwhile.
+static void serve_clipboard(Window root)
 {
-	const time_t now = clock();
-	const double elapsed = (double) (now - timer_start) / CLOCKS_PER_SEC;
-	if (elapsed >= 1.0) {
-		stop_timer_mode();
-		take_screenshot();
-		return;
+	if (!clipboard_image.pixels) return;
+
+	ClipboardOwner owner = {
+		.window = XCreateSimpleWindow(xdisplay, root, 0, 0, 1, 1, 0, 0, 0),
+		.clipboard = XInternAtom(xdisplay, "CLIPBOARD", False),
+		.targets = XInternAtom(xdisplay, "TARGETS", False),
+		.timestamp_atom = XInternAtom(xdisplay, "TIMESTAMP", False),
+		.incr = XInternAtom(xdisplay, "INCR", False)
+	};
+	for (u32 i = 0; i < CLIPBOARD_TARGETS_COUNT; i++) {
+		owner.image_targets[i] = XInternAtom(xdisplay, clipboard_targets[i].name, False);
 	}
 
-	scratch_buffer_clear();
-	scratch_buffer_printf("screenshot will be taken "
-												"in %.2lf seconds..",
-												10.0f-elapsed*10.0f);
+	// Both the chunks and single replies must fit into one request
+	const long max_request = XExtendedMaxRequestSize(xdisplay)
+		? XExtendedMaxRequestSize(xdisplay)
+		: XMaxRequestSize(xdisplay);
+	owner.chunk_size = MIN(CLIPBOARD_MAX_CHUNK, (usize) max_request*4 - 1024);
 
-	char *text = scratch_buffer_to_string();
+	XSelectInput(xdisplay, owner.window, PropertyChangeMask);
+	owner.timestamp = server_time(owner.window);
 
-	const float spacing = 2.0f;
-	const float font_size = 20.0f;
+	XSetSelectionOwner(xdisplay, owner.clipboard, owner.window, owner.timestamp);
+	if (XGetSelectionOwner(xdisplay, owner.clipboard) != owner.window) {
+		eprintf("could not take over the clipboard\n");
+		XDestroyWindow(xdisplay, owner.window);
+		return;
+	}
 
-	const Vector2 size = MeasureTextEx(font, text, font_size, spacing);
+	XErrorHandler old_handler = XSetErrorHandler(clipboard_error_handler);
 
-	const float x = GetScreenWidth()*0.97 - size.x;
-	const float y = GetScreenHeight()*0.97 - size.y;
+	bool owning = true;
+	while (owning || owner.transfers_count > 0) {
+		// Wakes up now and then to drop requestors that went quiet
+		if (!XPending(xdisplay)) {
+			struct pollfd fd = {.fd = ConnectionNumber(xdisplay), .events = POLLIN};
+			if (poll(&fd, 1, 1000) < 0 && errno != EINTR) break;
+		}
 
-	const float pad = 50.0f;
+		const u64 now = monotonic_ns();
+		for (u32 i = 0; i < owner.transfers_count;) {
+			if (now - owner.transfers[i].last_activity_ns > CLIPBOARD_TRANSFER_TIMEOUT_NS) {
+				end_transfer(&owner, i);
+			} else {
+				i++;
+			}
+		}
 
-	DrawRectangle(x - pad/2,
-								y - pad/2,
-								size.x + pad,
-								size.y + pad,
-								(Color){0, 0, 0, 150});
+		while (XPending(xdisplay)) {
+			XEvent event;
+			XNextEvent(xdisplay, &event);
+
+			if (event.type == SelectionClear && event.xselectionclear.selection == owner.clipboard) {
+				owning = false;
+			} else if (event.type == SelectionRequest) {
+				answer_selection_request(&owner, &event.xselectionrequest);
+			} else if (event.type == PropertyNotify && event.xproperty.state == PropertyDelete) {
+				for (u32 i = 0; i < owner.transfers_count; i++) {
+					ClipboardTransfer *transfer = &owner.transfers[i];
+					if (transfer->requestor != event.xproperty.window ||
+							transfer->property != event.xproperty.atom) continue;
+
+					if (!continue_transfer(transfer)) end_transfer(&owner, i);
+					XFlush(xdisplay);
+					break;
+				}
+			}
+		}
+	}
 
-	DrawTextEx(font,
-						 text,
-						 (Vector2) {x, y},
-						 font_size,
-						 spacing,
-						 WHITE);
+	XSetErrorHandler(old_handler);
+	XDestroyWindow(xdisplay, owner.window);
 }
 
-static void handle_color_selector_mode(void)
+// `socket` flag, or `$XDG_RUNTIME_DIR/ss.sock`, or `/tmp/ss-<uid>.sock`
+static void resolve_socket_path(void)
 {
-	const Vector2 rpos = Vector2Add(color_selector_entered_position,
-																	COLOR_SELECTOR_WINDOW_CURSOR_PADDING);
+	if (*socket_path) return;
 
-	DrawRectangleV(rpos, COLOR_SELECTOR_WINDOW_SIZE, WHITE);
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	int n;
+	if (runtime_dir && *runtime_dir) {
+		n = snprintf(socket_path, sizeof(socket_path), "%s/ss.sock", runtime_dir);
+	} else {
+		n = snprintf(socket_path, sizeof(socket_path), "/tmp/ss-%u.sock", (unsigned) getuid());
+	}
 
-	for (size_t color_idx = 0; color_idx < COLORS_COUNT; color_idx++) {
-		const Vector2 draw_pos = Vector2Add(rpos, COLOR_POSITIONS[color_idx]);
-		DrawRectangleV(draw_pos, COLOR_PREVIEW_SIZE, colors[color_idx]);
-		DrawRectangleLinesEx((Rectangle) {
-			.x = draw_pos.x, .y = draw_pos.y,
-			.width = COLOR_PREVIEW_SIZE.x, .height = COLOR_PREVIEW_SIZE.y
-		}, 1.0f, BLACK);
+	if (n < 0 || (size_t) n >= sizeof(socket_path)) {
+		panic("socket path is too long, provide a shorter one with the `socket` flag\n");
 	}
+}
 
-	DrawCircleV(GetMousePosition(),
-							brush_radius,
-							brush_color);
+INLINE static struct sockaddr_un socket_address(void)
+{
+	struct sockaddr_un addr = {0};
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+	return addr;
 }
 
-INLINE static void preserve_original_image_data(void)
+// Sends `trigger_command` to the daemon and prints whatever it answers,
+// returns the exit code of the client
+static int send_trigger(void)
 {
-	original_image_data = (u8 *) malloc(sizeof(RGB)*
-																			screenshot.width*
-																			screenshot.height);
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	const struct sockaddr_un addr = socket_address();
+	if (fd < 0 || connect(fd, (const struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		eprintf("could not connect to the daemon at `%s`: %s\n", socket_path, strerror(errno));
+		return 1;
+	}
 
-	memcpy(original_image_data,
-				 screenshot.data,
-				 sizeof(RGB)*screenshot.width*screenshot.height);
-}
+	dprintf(fd, "%s\n", trigger_command);
+	shutdown(fd, SHUT_WR);
 
-static size_t argc;
-#define FLAG_CAP 256
-static char **argv, flag_value[FLAG_CAP + 1];
+	char buf[256];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		fwrite(buf, 1, n, stdout);
+	}
 
-INLINE static int check_flag(char *flag, bool expect_value)
-{
-	scratch_buffer_clear();
-	scratch_buffer_append(flag);
-	char *lowerflag = scratch_buffer_copy();
+	close(fd);
+	return 0;
+}
 
-	for (size_t i = 1; i < argc; ++i) {
-		if (strcaseeq(lowerflag, argv[i])) {
-			if (!expect_value) return PASSED;
+static int listen_on_socket(void)
+{
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		panic("could not create socket: %s\n", strerror(errno));
+	}
 
-			if (i + 1 >= argc)
-				return PASSED_WITHOUT_VALUE_UNEXPECTEDLY;
+	// Only a socket nobody listens on anymore gets replaced
+	const struct sockaddr_un addr = socket_address();
+	const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (connect(probe, (const struct sockaddr *) &addr, sizeof(addr)) == 0) {
+		panic("another daemon already listens at `%s`\n", socket_path);
+	}
+	close(probe);
+	unlink(socket_path);
 
-			memcpy(flag_value, argv[i + 1], FLAG_CAP);
-			return PASSED;
-		} else {
-			char *pos = strchr(argv[i], '=');
-			if (pos == NULL) continue;
+	if (bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		panic("could not listen at `%s`: %s\n", socket_path, strerror(errno));
+	}
 
-			const size_t idx = pos - argv[i];
-			scratch_buffer_clear();
-			memcpy(scratch_buffer.str, argv[i], idx);
-			scratch_buffer.len = idx;
-			scratch_buffer_append_char('\0');
+	return fd;
+}
 
-			const char *flag_str = TextToLower(scratch_buffer.str);
+static bool hotkey_grab_failed = false;
 
-			if (!strcaseeq(lowerflag, flag_str)) continue;
-			if (!expect_value) return PASSED;
+static int hotkey_error_handler(Display *display UNUSED, XErrorEvent *event UNUSED)
+{
+	hotkey_grab_failed = true;
+	return 0;
+}
 
-			scratch_buffer_clear();
-			scratch_buffer_append(argv[i] + idx + 1);
-			scratch_buffer_append_char('\0');
+// Grabs `hotkey` with any modifiers, returns its keycode or 0 when
+// there is no hotkey or another client has already grabbed it
+static KeyCode grab_hotkey(Window root)
+{
+	if (hotkey == NoSymbol) return 0;
 
-			// characters after `=`
-			char *flag_value_str = scratch_buffer_to_string();
+	const KeyCode keycode = XKeysymToKeycode(xdisplay, hotkey);
+	if (!keycode) {
+		panic("hotkey `%s` isn't on the keyboard\n", XKeysymToString(hotkey));
+	}
 
-			if (flag_value_str == NULL || *flag_value_str == '\0')
-				return PASSED_WITHOUT_VALUE_UNEXPECTEDLY;
+	hotkey_grab_failed = false;
+	XErrorHandler old_handler = XSetErrorHandler(hotkey_error_handler);
+	XGrabKey(xdisplay, keycode, AnyModifier, root, True, GrabModeAsync, GrabModeAsync);
+	XSync(xdisplay, False);
+	XSetErrorHandler(old_handler);
 
-			memcpy(flag_value, flag_value_str, FLAG_CAP);
-			return PASSED;
-		}
+	if (hotkey_grab_failed) {
+		panic("could not grab hotkey `%s`, another client holds it\n", XKeysymToString(hotkey));
 	}
 
-	return NOT_PASSED;
+	return keycode;
 }
 
-INLINE static Color color_try_from_str(const char *str)
+// Reads a command line from a freshly accepted client
+static bool read_command(int client_fd, char *command)
 {
-	const size_t len = strlen(str);
-	const char *upper_str = TextToUpper(str);
-	if (is_color(upper_str, len) == NULL) {
-		return BLANK;
-	} else {
-		return color_map[hash(upper_str, len)];
+	const u64 deadline = monotonic_ns() + DAEMON_COMMAND_TIMEOUT_MS*1000000ull;
+
+	size_t len = 0;
+	while (len < DAEMON_COMMAND_CAP - 1) {
+		const u64 now = monotonic_ns();
+		if (now >= deadline) break;
+
+		// Waits for the command no longer than the hotkey can stand
+		struct pollfd fd = {.fd = client_fd, .events = POLLIN};
+		const int ready = poll(&fd, 1, (int) ((deadline - now + 999999) / 1000000));
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready <= 0) break;
+
+		const ssize_t n = read(client_fd, command + len, DAEMON_COMMAND_CAP - 1 - len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		len += n;
+		if (memchr(command, '\n', len)) break;
 	}
+
+	command[len] = '\0';
+	char *newline = strchr(command, '\n');
+	if (newline) *newline = '\0';
+	return len > 0;
 }
 
-INLINE static float parse_float_or_panic(const char *str)
+// Does what `ss screenshot` would, over the daemon's warm connection and buffers
+static void daemon_screenshot(Window root, int client_fd)
 {
-	char *end;
-	const float ret = strtof(str, &end);
-	if (end == flag_value || *end != '\0') {
-		panic("failed to parse `%s` to float\n", str);
-	} else if (errno == ERANGE) {
-		if (ret == HUGE_VAL) {
-			panic("overflew when tried to parse `%s` to float\n", str);
-		} else {
-			panic("underflew when tried to parse `%s` to float\n", str);
-		}
-	}
-	return ret;
+	const region_t area = region_provided
+		? resolve_region(gwa)
+		: monitor_area(root, gwa);
+
+	capture_screen(root, gwa, area);
+	save_image_data(screenshot.data, screenshot.width, screenshot.height);
+	if (client_fd >= 0) dprintf(client_fd, "saved\n");
 }
 
-INLINE static void provided_flag_example(const char *flag)
+// Same as a standalone interactive run, minus the startup
+static void daemon_overlay(Window root, u64 trigger_ns, int client_fd,
+													 Color initial_brush_color, float initial_brush_radius)
 {
-	printf("try to provide a flag following way:\n");
-	printf("%s=<value> or %s <value>\n", flag, flag);
+	// Queued saves still read the previous capture
+	save_queue_wait();
+
+	capture_screen(root, gwa, monitor_area(root, gwa));
+	preserve_original_image_data();
+	load_overlay_textures();
+
+	ClearWindowState(FLAG_WINDOW_HIDDEN);
+	reset_overlay_state(initial_brush_color, initial_brush_radius);
+	run_overlay(trigger_ns, client_fd);
+	SetWindowState(FLAG_WINDOW_HIDDEN);
+
+	// raylib only refreshes its close flag from GLFW's, which stays set until
+	// the window is gone, so the next overlay would close before its first frame
+	glfwSetWindowShouldClose((GLFWwindow *) GetWindowHandle(), 0);
+	PollInputEvents();
+
+	// The hotkey pressed while the overlay was up shouldn't bring it right back
+	XSync(xdisplay, False);
+	while (XPending(xdisplay)) {
+		XEvent event;
+		XNextEvent(xdisplay, &event);
+	}
 }
 
-static void handle_flags(void)
+// Waits for triggers until a `quit` command or a signal
+static void run_daemon(Window root)
 {
-	int code;
+	resolve_socket_path();
+	const int listen_fd = listen_on_socket();
+	const KeyCode hotkey_code = grab_hotkey(root);
 
-	code = check_flag(IMMEDIATE_SCREENSHOT_AND_EXIT_FLAG, false);
-	if (code == PASSED) {
-		immediate_screenshot_and_exit = true;
-	}
+	// A client gone before it was answered must not take the daemon with it
+	signal(SIGPIPE, SIG_IGN);
 
-	code = check_flag("brush_color", true);
-	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
-		panic("expected `brush_color` flag to have a value\n");
-	} else if (code == PASSED) {
-		const Color new_brush_color = color_try_from_str(flag_value);
-		if (memcmp(&new_brush_color, &BLANK, sizeof(Color)) == 0) {
-			eprintf("unexpected color: `%s`\n", flag_value);
-			provided_flag_example("brush_color");
-			exit(1);
+	init_raylib();
+
+	const Color initial_brush_color = brush_color;
+	const float initial_brush_radius = brush_radius;
+
+	eprintf("listening at `%s`\n", socket_path);
+
+	for (bool quit = false; !quit;) {
+		struct pollfd fds[2] = {
+			{.fd = listen_fd, .events = POLLIN},
+			{.fd = ConnectionNumber(xdisplay), .events = POLLIN}
+		};
+
+		// Events may already sit in Xlib's queue, which poll can't see
+		if (!XPending(xdisplay) && poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			panic("poll failed: %s\n", strerror(errno));
 		}
 
-		brush_color = new_brush_color;
-	}
+		while (XPending(xdisplay)) {
+			XEvent event;
+			XNextEvent(xdisplay, &event);
+			if (event.type != KeyPress || event.xkey.keycode != hotkey_code) continue;
 
-	code = check_flag("brush_radius", true);
-	if (code == PASSED_WITHOUT_VALUE_UNEXPECTEDLY) {
-		panic("expected `brush_radius` flag to have a value\n");
-	} else if (code == PASSED) {
-		brush_radius = parse_float_or_panic(flag_value);
+			const u64 trigger_ns = monotonic_ns();
+			XGetWindowAttributes(xdisplay, root, &gwa);
+			query_crtcs(root, gwa);
+			daemon_overlay(root, trigger_ns, -1, initial_brush_color, initial_brush_radius);
+		}
+
+		if (!(fds[0].revents & POLLIN)) continue;
+
+		const int client_fd = accept(listen_fd, NULL, NULL);
+		if (client_fd < 0) continue;
+
+		const u64 trigger_ns = monotonic_ns();
+
+		char command[DAEMON_COMMAND_CAP];
+		if (!read_command(client_fd, command)) {
+			close(client_fd);
+			continue;
+		}
+
+		// Monitors may have been plugged or rearranged since the last trigger
+		XGetWindowAttributes(xdisplay, root, &gwa);
+		query_crtcs(root, gwa);
+
+		if (strcaseeq(command, DAEMON_COMMAND_OVERLAY)) {
+			daemon_overlay(root, trigger_ns, client_fd, initial_brush_color, initial_brush_radius);
+		} else if (strcaseeq(command, DAEMON_COMMAND_SCREENSHOT)) {
+			daemon_screenshot(root, client_fd);
+		} else if (strcaseeq(command, DAEMON_COMMAND_QUIT)) {
+			quit = true;
+		} else {
+			dprintf(client_fd, "unknown command: `%s`\n", command);
+		}
+
+		close(client_fd);
 	}
+
+	close(listen_fd);
+	unlink(socket_path);
+}
+
+#if STATS
+static void print_stats(void)
+{
+	stats_report(stderr, stats_json);
 }
+#endif
 
 i32 main(int argc_, char **argv_)
 {
+	const u64 start_ns = monotonic_ns();
+
 	argc = (size_t) argc_;
 	argv = argv_;
 
@@ -1207,74 +3682,74 @@ i32 main(int argc_, char **argv_)
 		handle_flags();
 	}
 
+	// Clients only pass the command on, they don't need the display at all
+	if (trigger_command) {
+		resolve_socket_path();
+		const int code = send_trigger();
+		memory_release();
+		return code;
+	}
+
+#if STATS
+	if (stats_requested) atexit(print_stats);
+#endif
+
+	// Monitors are grabbed from several threads, each with its own connection
+	XInitThreads();
+
 	xdisplay = XOpenDisplay(NULL);
 	if (!xdisplay) {
 		panic("could not to open X display");
 	}
 
+	shm.display = xdisplay;
+
 	const Window root = DefaultRootWindow(xdisplay);
 	XGetWindowAttributes(xdisplay, root, &gwa);
+	query_crtcs(root, gwa);
 
 	cur_pos = (Vector2) {center_x, center_y};
-	output_file_name_len = strlen(OUTPUT_FILE_NAME);
 
-	capture_screen(root, gwa);
-	preserve_original_image_data();
+	if (immediate_screenshot_and_exit || interval_ms) {
+		// Nothing can be drawn over the capture here, so it's saved as is,
+		// without keeping another copy of it around
+		const region_t area = region_provided
+			? resolve_region(gwa)
+			: monitor_area(root, gwa);
+
+		if (interval_ms) {
+			run_interval_capture(root, gwa, area);
+		} else if (handoff_path[0]) {
+			handoff_screenshot(root, gwa, area);
+		} else if (output_format->encode == encode_png && !clipboard_mode) {
+			stream_screenshot(root, gwa, area);
+		} else {
+			capture_screen(root, gwa, area);
+			save_image_data(screenshot.data, screenshot.width, screenshot.height);
+		}
 
-	if (immediate_screenshot_and_exit) {
-		save_fullscreen();
+		if (clipboard_mode) {
+			UnloadImage(screenshot);
+			screenshot = (Image) {0};
+			serve_clipboard(root);
+		}
 		exit(0);
 	}
 
-	init_raylib();
-
-	canvas = LoadRenderTexture(gwa.width, gwa.height);
-	clear_canvas();
-
-	screenshot_texture = LoadTextureFromImage(screenshot);
-	darker_screenshot_texture = LoadTextureFromImage(darker_screenshot);
-
-	while (!WindowShouldClose()) {
-		handle_input();
-		BeginDrawing();
-		{
-			ClearBackground(BACKGROUND_COLOR);
-			if (selection_mode) {
-				draw_selection();
-			} else if (alt_mode || drawing_now || color_selector_mode) {
-				DrawTextureEx(screenshot_texture,
-											image_pos,
-											0,
-											zoom,
-											WHITE);
-
-			} else {
-				DrawTextureEx(darker_screenshot_texture,
-											image_pos,
-											0,
-											zoom,
-											WHITE);
-
-				DrawCollisionTextureCircle(screenshot_texture,
-																	 image_pos,
-																	 cur_pos,
-																	 radius,
-																	 WHITE);
-			}
-
-			draw_canvas();
-
-			if (timer_mode) {
-				handle_timer_mode();
-			}
+	if (daemon_mode) {
+		run_daemon(root);
+	} else {
+		capture_screen(root, gwa, monitor_area(root, gwa));
+		preserve_original_image_data();
 
-			if (color_selector_mode) {
-				handle_color_selector_mode();
-			}
-		}
-		EndDrawing();
+		init_raylib();
+		load_overlay_textures();
+		// With `stats` the first frame is timed from the start of `main`
+		run_overlay(stats_requested ? start_ns : 0, -1);
 	}
 
+	save_queue_wait();
+
 #define X UnloadImage
 	XSCREENSHOTS
 #undef X
@@ -1284,6 +3759,18 @@ i32 main(int argc_, char **argv_)
 #undef X
 
 	deinit_raylib();
+	shm_release(&shm);
+	release_crtc_connections();
+	if (pool_initialized) pool_deinit(&pool);
+
+	// Only the saved image is left in memory while the clipboard is served
+	if (clipboard_mode) {
+		assert(save_queue_idle());
+		free(original_image_data);
+		original_image_data = NULL;
+		serve_clipboard(root);
+	}
+
 	XCloseDisplay(xdisplay);
 
 	if (argc > 1) {
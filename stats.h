@@ -0,0 +1,166 @@
+/*
+  Per-phase timers and allocation counters, printed by the `stats` flag.
+
+  A phase is timed by a `STATS_BEGIN(name)`/`STATS_END(name)` pair in one
+  scope, and the image sized buffers (captures, canvas snapshots, save and
+  encode outputs) are counted with `STATS_ALLOC(bytes)` where they are
+  allocated, from any thread. Small bookkeeping allocations aren't counted. Anything else worth a total is added up with
+  `STATS_COUNT(name, n)`. Building with -DSTATS=0 turns all of them
+  into nothing.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#ifndef STATS
+#define STATS 1
+#endif
+
+#define XPHASES \
+	X(capture) \
+	X(convert) \
+	X(preserve) \
+	X(upload) \
+	X(readback) \
+	X(composite) \
+	X(encode) \
+	X(write)
+
+enum {
+#define X(name) PHASE_##name,
+	XPHASES
+#undef X
+	PHASES_COUNT
+};
+
+// Canvas tiles read back for saves
+#define XCOUNTERS \
+	X(canvas_tiles)
+
+enum {
+#define X(name) COUNTER_##name,
+	XCOUNTERS
+#undef X
+	COUNTERS_COUNT
+};
+
+#if STATS
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+
+static const char *phase_names[PHASES_COUNT] = {
+#define X(name) #name,
+	XPHASES
+#undef X
+};
+
+typedef struct {
+	uint64_t calls, total_ns, max_ns;
+} PhaseStats;
+
+static PhaseStats phase_stats[PHASES_COUNT] = {0};
+
+static const char *counter_names[COUNTERS_COUNT] = {
+#define X(name) #name,
+	XCOUNTERS
+#undef X
+};
+
+static uint64_t counters[COUNTERS_COUNT] = {0};
+static uint64_t buffer_bytes = 0, buffers_count = 0;
+
+static inline uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static inline void stats_phase_end(uint32_t phase, uint64_t start_ns)
+{
+	const uint64_t ns = stats_now_ns() - start_ns;
+	PhaseStats *s = &phase_stats[phase];
+	__atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+
+	uint64_t max_ns = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+	while (ns > max_ns && !__atomic_compare_exchange_n(&s->max_ns, &max_ns, ns, true,
+																										 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+#define STATS_BEGIN(name) const uint64_t stats_start_##name = stats_now_ns()
+#define STATS_END(name) stats_phase_end(PHASE_##name, stats_start_##name)
+#define STATS_ALLOC(bytes) do { \
+	__atomic_fetch_add(&buffer_bytes, (uint64_t) (bytes), __ATOMIC_RELAXED); \
+	__atomic_fetch_add(&buffers_count, 1, __ATOMIC_RELAXED); \
+} while (0)
+#define STATS_COUNT(name, n) \
+	__atomic_fetch_add(&counters[COUNTER_##name], (uint64_t) (n), __ATOMIC_RELAXED)
+
+// Peak resident set size of the whole process, in KiB
+static inline long stats_peak_rss_kib(void)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+	return usage.ru_maxrss;
+}
+
+static void stats_report(FILE *f, bool json)
+{
+	const long peak_rss = stats_peak_rss_kib();
+
+	if (json) {
+		fprintf(f, "{\"phases\": {");
+		for (uint32_t i = 0; i < PHASES_COUNT; i++) {
+			const PhaseStats *s = &phase_stats[i];
+			fprintf(f, "%s\"%s\": {\"calls\": %llu, \"total_ms\": %.3f, \"max_ms\": %.3f}",
+							i ? ", " : "",
+							phase_names[i],
+							(unsigned long long) s->calls,
+							s->total_ns / 1e6,
+							s->max_ns / 1e6);
+		}
+		fprintf(f, "}, \"counters\": {");
+		for (uint32_t i = 0; i < COUNTERS_COUNT; i++) {
+			fprintf(f, "%s\"%s\": %llu", i ? ", " : "", counter_names[i],
+							(unsigned long long) counters[i]);
+		}
+		fprintf(f, "}, \"peak_rss_kib\": %ld, \"buffer_bytes\": %llu, \"buffers\": %llu}\n",
+						peak_rss,
+						(unsigned long long) buffer_bytes,
+						(unsigned long long) buffers_count);
+		return;
+	}
+
+	fprintf(f, "%-10s %6s %12s %12s\n", "phase", "calls", "total ms", "max ms");
+	for (uint32_t i = 0; i < PHASES_COUNT; i++) {
+		const PhaseStats *s = &phase_stats[i];
+		fprintf(f, "%-10s %6llu %12.3f %12.3f\n",
+						phase_names[i],
+						(unsigned long long) s->calls,
+						s->total_ns / 1e6,
+						s->max_ns / 1e6);
+	}
+	for (uint32_t i = 0; i < COUNTERS_COUNT; i++) {
+		fprintf(f, "%-10s %6llu\n", counter_names[i], (unsigned long long) counters[i]);
+	}
+	fprintf(f, "peak rss: %ld KiB\n", peak_rss);
+	fprintf(f, "image buffers: %llu bytes in %llu allocations\n",
+					(unsigned long long) buffer_bytes,
+					(unsigned long long) buffers_count);
+}
+
+#else
+
+#define STATS_BEGIN(name)
+#define STATS_END(name)
+#define STATS_ALLOC(bytes) do {} while (0)
+#define STATS_COUNT(name, n) do {} while (0)
+
+#endif // STATS
+
+#endif // STATS_H